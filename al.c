@@ -1,441 +1,3863 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
 /* uncomment to ignore the assertions (no debug) */
 // #define NDEBUG
 #include <assert.h>
 
 #include "al.h"
 
+#define SNAPSHOT_MAGIC 0x314c4153 /* "SAL1" */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BUFFER_SIZE (1 << 16)
+#define TEXT_BLOCK_SIZE (1 << 20)
+#define WRITE_BUFFER_SIZE (1 << 20)
+#define WRITE_CHUNK_SIZE (1 << 16)
+#define INDEX_MIN_CAPACITY 16
+#define SPARSE_BLOCK_SIZE 64
+#define SPARSE_MIN_CAPACITY 4
+#define REGISTRY_MIN_SIZE 64
+#define REGISTRY_LOW_WATER 0.75
+#define REGISTRY_HEADROOM 4
+
+#ifdef AL_STATS
+#define STAT(list, field, n) ((list)->stats.field += (n))
+#define STAT_PEAK(list) if((list)->memory_size > (list)->stats.peak_memory_size) (list)->stats.peak_memory_size = (list)->memory_size
+#else
+#define STAT(list, field, n)
+#define STAT_PEAK(list)
+#endif
+
+#ifdef AL_STATS_LATENCY
+#define LATENCY_START uint64_t latency_start = nanoseconds()
+#define LATENCY_END(list, op) recordLatency(list, op, latency_start)
+#else
+#define LATENCY_START
+#define LATENCY_END(list, op)
+#endif
+#define CHECKSUM_INIT 14695981039346656037ULL
+#define CHECKSUM_PRIME 1099511628211ULL
+
+/*
+ * Snapshot file layout (native byte order):
+ *
+ *   header | offset table: size+1 uint64_t | data: concatenated payloads
+ *
+ * The offsets are relative to the start of the data. If all payloads have
+ * the same length, stride holds it and readers may skip the table.
+ */
+typedef struct SnapshotHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	uint64_t stride;
+	uint64_t data_size;
+	uint64_t table_checksum;
+	uint64_t data_checksum;
+	uint64_t header_checksum;
+} SnapshotHeader;
+
+typedef struct WriteChunk
+{
+	AL *list;
+	unsigned long start;
+	unsigned long end;
+	unsigned long (*formatFn)(void*, char*, unsigned long);
+	char *buffer;
+	unsigned long size;
+	unsigned long used;
+	int failed;
+} WriteChunk;
+
+/*
+ * Node of the treap which al_applyBatch builds over the new order of the
+ * elements. A node is a run of the old array or a single new element.
+ */
+typedef struct BatchNode
+{
+	struct BatchNode *left;
+	struct BatchNode *right;
+	unsigned long priority;
+	unsigned long size;
+	unsigned long start;
+	unsigned long length;
+	void *data;
+} BatchNode;
+
+typedef struct MoveChunk
+{
+	AL *src;
+	void **to;
+	void **from;
+	const unsigned long *indexes;
+	unsigned long start;
+	unsigned long end;
+} MoveChunk;
+
+/*
+ * Registry of live array lists, see al_register. lists[i]->registered is i.
+ */
+typedef struct Registry
+{
+	AL **lists;
+	unsigned long size;
+	unsigned long memory_size;
+	unsigned long budget;
+	unsigned long trims;
+	unsigned long trimmed;
+	unsigned long reserved;
+	int over;
+	int track;
+} Registry;
+
+static Registry registry = { NULL, 0, 0, 0, 0, 0, 0, 0, 0 };
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct BatchPool
+{
+	BatchNode *nodes;
+	unsigned long used;
+	uint64_t seed;
+} BatchPool;
+
+static uint64_t checksum(uint64_t hash, const void *data, unsigned long length);
+static uint64_t headerChecksum(SnapshotHeader header);
+static int readAll(int fd, void *buffer, unsigned long length);
+static int writeAll(int fd, const void *buffer, unsigned long length);
+static int pwriteAll(int fd, const void *buffer, unsigned long length, off_t offset);
+static int writevAll(int fd, struct iovec *iov, int count);
+static void* formatChunk(void *arg);
+static void* gatherChunk(void *arg);
+static void* scatterChunk(void *arg);
+static void runChunks(void* (*chunkFn)(void*), AL *src, void **to, void **from, const unsigned long *indexes, unsigned long count);
+static int mapInvalid(const SnapshotHeader *header);
+static const void* mapGet(ALMap *map, unsigned long index);
+static void* at(AL *list, unsigned long index);
+static unsigned long hashOf(ALIndex *index, void *data);
+static void indexInsert(ALIndex *index, void *data, unsigned long hash, unsigned long position);
+static void indexRemove(ALIndex *index, void *data, unsigned long position);
+static int indexResize(ALIndex *index, unsigned long capacity);
+static void indexAppend(AL *list, void *data, unsigned long position);
+static unsigned long indexPosition(ALIndex *index, ALIndexEntry *entry);
+static void indexRepair(ALIndex *index);
+static void indexShift(AL *list, unsigned long position, long delta);
+static void indexDelete(AL *list, void *data, unsigned long position);
+static void indexInvalidate(AL *list);
+static int indexRebuild(AL *list);
+static long indexFind(AL *list, void *data);
+static void treeAdd(ALTombstones *tombstones, unsigned long word, long delta);
+static int tombstonesResize(ALTombstones *tombstones, unsigned long slots);
+static unsigned long slotOf(ALTombstones *tombstones, unsigned long index);
+static void* bury(AL *list, unsigned long index);
+static void compact(AL *list);
+static void settle(AL *list);
+static void* sparseGet(ALSparse *sparse, unsigned long index);
+static int sparseReserve(ALSparse *sparse, unsigned long size);
+static void* sparseSet(ALSparse *sparse, unsigned long index, void *data);
+static int densify(AL *list);
+static unsigned long slack(AL *list);
+static int compareSlack(const void *a, const void *b);
+static unsigned long trimList(AL *list, unsigned long bytes);
+static unsigned long trimLocked(unsigned long bytes);
+static void accountLocked(AL *list);
+static void account(AL *list, int growing);
+static void pressure(AL *list);
+static void init(AL *list, void **array, unsigned long size, unsigned long memory_size);
+static void shrink(AL *list);
+static void siftUp(AL *list, unsigned long index);
+static void siftDown(AL *list, unsigned long index, unsigned long size, int order);
+static void shared(void *data);
+static unsigned long gallop(int (*compareFn)(void*, void*), AL *list, unsigned long start, void *data, int strict);
+static void appendRange(AL *out, AL *list, unsigned long start, unsigned long end);
+static AL* setOutput(AL *a, AL *b, AL *out, unsigned long size);
+static BatchNode* batchNode(BatchPool *pool, unsigned long start, unsigned long length, void *data);
+static void batchUpdate(BatchNode *node);
+static BatchNode* batchMerge(BatchNode *left, BatchNode *right);
+static void batchSplit(BatchPool *pool, BatchNode *node, unsigned long count, BatchNode **left, BatchNode **right);
+static void batchCollect(BatchNode *node, void **old, void **new, unsigned long *size);
+#ifdef AL_STATS_LATENCY
+static uint64_t nanoseconds(void);
+static void recordLatency(AL *list, int op, uint64_t start);
+#endif
+static int reserve(AL *list, unsigned long size);
+static unsigned long countLines(const char *text, unsigned long length);
+static unsigned long parseLines(AL *list, const char *text, unsigned long length, void* (*parseFn)(const char*, unsigned long));
 static void increase(AL *list, unsigned long start, unsigned long size, void** data);
 static void decrease(AL *list, unsigned long start, unsigned long end);
 static void increaseOne(AL *list, unsigned long index, void *data);
 static void decreaseOne(AL *list, unsigned long index);
 
 
-void increase(AL *list, unsigned long start, unsigned long size, void** data)
+/* FNV-1a */
+uint64_t checksum(uint64_t hash, const void *data, unsigned long length)
 {
-	assert(ADD_THRESHOLD >= 1);
+	const unsigned char *bytes = data;
+	unsigned long i;
+	for(i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= CHECKSUM_PRIME;
+	}
+	return hash;
+}
 
-	if(start > list->size)
-		start = list->size;
+uint64_t headerChecksum(SnapshotHeader header)
+{
+	header.header_checksum = 0;
+	return checksum(CHECKSUM_INIT, &header, sizeof(SnapshotHeader));
+}
 
-	unsigned long n = start+size;
-	if(ADD_THRESHOLD * (list->size+size) >= list->memory_size)
+int readAll(int fd, void *buffer, unsigned long length)
+{
+	char *p = buffer;
+	while(length > 0)
 	{
-		list->memory_size = list->size * ADD_SIZE_MULTIPLY_FACTOR;
-		void **new = malloc(sizeof(void *) * list->memory_size);
+		ssize_t n = read(fd, p, length);
+		if(n <= 0)
+			return -1;
+		p += n;
+		length -= n;
+	}
+	return 0;
+}
 
-		unsigned long i;
-		for(i = 0; i < start; i++)
+int writeAll(int fd, const void *buffer, unsigned long length)
+{
+	const char *p = buffer;
+	while(length > 0)
+	{
+		ssize_t n = write(fd, p, length);
+		if(n < 0)
+			return -1;
+		p += n;
+		length -= n;
+	}
+	return 0;
+}
+
+int pwriteAll(int fd, const void *buffer, unsigned long length, off_t offset)
+{
+	const char *p = buffer;
+	while(length > 0)
+	{
+		ssize_t n = pwrite(fd, p, length, offset);
+		if(n < 0)
+			return -1;
+		p += n;
+		offset += n;
+		length -= n;
+	}
+	return 0;
+}
+
+int writevAll(int fd, struct iovec *iov, int count)
+{
+	while(count > 0)
+	{
+		ssize_t n = writev(fd, iov, count);
+		if(n < 0)
+			return -1;
+		while(count > 0 && (size_t) n >= iov->iov_len)
 		{
-			new[i] = list->array[i];
+			n -= iov->iov_len;
+			iov++;
+			count--;
 		}
-		for(i = 0; i < size; i++)
+		if(count > 0)
 		{
-			new[i+start] = data[i];
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Format the elements of a chunk into its buffer, growing the buffer as
+ * needed. Runs on a worker thread.
+ */
+void* formatChunk(void *arg)
+{
+	WriteChunk *chunk = arg;
+	unsigned long i;
+
+	chunk->used = 0;
+	for(i = chunk->start; i < chunk->end; i++)
+	{
+		void *data = at(chunk->list, i);
+		unsigned long n;
+		while((n = chunk->formatFn(data, chunk->buffer + chunk->used, chunk->size - chunk->used)) > chunk->size - chunk->used)
+		{
+			unsigned long size = chunk->size * 2;
+			if(size < chunk->used + n)
+				size = chunk->used + n;
+			char *new = realloc(chunk->buffer, size);
+			if(!new)
+			{
+				chunk->failed = 1;
+				return NULL;
+			}
+			chunk->buffer = new;
+			chunk->size = size;
 		}
-		for(i = start; i <= list->size; i++) // or list->size+1
+		chunk->used += n;
+	}
+	return NULL;
+}
+
+/*
+ * to[i] = src[indexes[i]] for the chunk.
+ */
+void* gatherChunk(void *arg)
+{
+	MoveChunk *chunk = arg;
+	unsigned long i;
+
+	if(chunk->from)
+	{
+		for(i = chunk->start; i < chunk->end; i++)
 		{
-			new[i+n] = list->array[i];
+			chunk->to[i] = chunk->from[chunk->indexes[i]];
 		}
-		free(list->array);
-		list->array = new;
-	} else {
-		unsigned long i;
-		for(i = list->size; i > start; i--)
+	}
+	else
+	{
+		for(i = chunk->start; i < chunk->end; i++)
 		{
-			list->array[i] = list->array[i-1];
+			chunk->to[i] = at(chunk->src, chunk->indexes[i]);
 		}
-		for(i = 0; i < size; i++)
+	}
+	return NULL;
+}
+
+/*
+ * to[indexes[i]] = src[i] for the chunk.
+ */
+void* scatterChunk(void *arg)
+{
+	MoveChunk *chunk = arg;
+	unsigned long i;
+
+	if(chunk->from)
+	{
+		for(i = chunk->start; i < chunk->end; i++)
 		{
-			list->array[i+start] = data[i];
+			chunk->to[chunk->indexes[i]] = chunk->from[i];
 		}
 	}
-	list->size += size;
+	else
+	{
+		for(i = chunk->start; i < chunk->end; i++)
+		{
+			chunk->to[chunk->indexes[i]] = at(chunk->src, i);
+		}
+	}
+	return NULL;
+}
 
-	free(data);
-	data = NULL;
+/*
+ * Split count moves into MAX_THREADS chunks if there are at least
+ * THREAD_MIN_SIZE of them. from is NULL if src isn't a plain array.
+ */
+void runChunks(void* (*chunkFn)(void*), AL *src, void **to, void **from, const unsigned long *indexes, unsigned long count)
+{
+	MoveChunk chunks[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	int started[MAX_THREADS];
+	int threads_count = count >= THREAD_MIN_SIZE ? MAX_THREADS : 1;
+	int t;
+
+	for(t = 0; t < threads_count; t++)
+	{
+		chunks[t].src = src;
+		chunks[t].to = to;
+		chunks[t].from = from;
+		chunks[t].indexes = indexes;
+		chunks[t].start = count / threads_count * t;
+		chunks[t].end = t == threads_count - 1 ? count : count / threads_count * (t + 1);
+		started[t] = t > 0 && pthread_create(&threads[t], NULL, chunkFn, &chunks[t]) == 0;
+		if(t > 0 && !started[t])
+			chunkFn(&chunks[t]);
+	}
+	chunkFn(&chunks[0]);
+
+	for(t = 1; t < threads_count; t++)
+	{
+		if(started[t])
+			pthread_join(threads[t], NULL);
+	}
 }
 
-void decrease(AL *list, unsigned long start, unsigned long end)
+/*
+ * Check the offset table of a mapped snapshot, which is used to read the
+ * file: the offsets have to be ascending and the last one ends the data.
+ * With a stride, the elements have to fill the data exactly.
+ */
+int mapInvalid(const SnapshotHeader *header)
 {
-	assert(list);
-	assert(start <= end);
-	assert(end < list->size);
+	const uint64_t *offsets = (const uint64_t *) (header + 1);
+	unsigned long table_size = sizeof(uint64_t) * (header->size + 1);
+
+	if(checksum(CHECKSUM_INIT, offsets, table_size) != header->table_checksum
+		|| offsets[0] != 0
+		|| offsets[header->size] != header->data_size)
+		return 1;
+	if(header->stride && header->data_size / header->stride != header->size)
+		return 1;
 
-	unsigned long range = end-start+1;
 	unsigned long i;
-	for(i = start; i <= end; i++)
+	for(i = 0; i < header->size; i++)
 	{
-		list->freeFn(list->array[i]);
+		if(offsets[i] > offsets[i+1])
+			return 1;
 	}
+	return 0;
+}
 
-	if(DEL_THRESHOLD * (list->size-range) <= list->memory_size && list->size >= MIN_SIZE)
+const void* mapGet(ALMap *map, unsigned long index)
+{
+	if(map->stride)
+		return map->data + index * map->stride;
+	else
+		return map->data + map->offsets[index];
+}
+
+void* at(AL *list, unsigned long index)
+{
+	if(list->map)
+		return (void *) mapGet(list->map, index);
+	else if(list->sparse)
+		return sparseGet(list->sparse, index);
+	else if(list->tombstones && list->tombstones->dead)
+		return list->array[slotOf(list->tombstones, index)];
+	else
+		return list->array[index];
+}
+
+#ifdef AL_STATS_LATENCY
+uint64_t nanoseconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* bucket b counts the operations which took [2^(b-1), 2^b) ns */
+void recordLatency(AL *list, int op, uint64_t start)
+{
+	uint64_t elapsed = nanoseconds() - start;
+	int bucket = elapsed ? 64 - __builtin_clzll(elapsed) : 0;
+	if(bucket >= AL_STATS_BUCKETS)
+		bucket = AL_STATS_BUCKETS - 1;
+	list->stats.latency[op][bucket]++;
+}
+#endif
+
+unsigned long hashOf(ALIndex *index, void *data)
+{
+	if(index->hashFn)
+		return index->hashFn(data);
+
+	/* Fibonacci hashing of the address */
+	uint64_t h = (uintptr_t) data * 11400714819323198485ULL;
+	return h ^ (h >> 32);
+}
+
+/*
+ * The index is an open addressing hash table with linear probing. Entries
+ * are removed by shifting the following entries of the probe sequence back,
+ * so there are no tombstones. Empty slots have data NULL.
+ */
+void indexInsert(ALIndex *index, void *data, unsigned long hash, unsigned long position)
+{
+	unsigned long mask = index->capacity - 1;
+	unsigned long i = hash & mask;
+
+	while(index->entries[i].data)
 	{
-		list->memory_size /= DEL_SIZE_DIVIDE_FACTOR;
-		void **new = malloc(sizeof(void *) * list->memory_size);
+		i = (i + 1) & mask;
+	}
+	index->entries[i].data = data;
+	index->entries[i].hash = hash;
+	index->entries[i].position = position;
+	index->entries[i].shifts = index->shifts_count;
+	index->count++;
+}
 
-		unsigned long i;
-		for(i = 0; i < start; i++)
-		{
-			new[i] = list->array[i];
-		}
-		for(i = start; i < list->size; i++)
-		{
-			new[i] = list->array[i+range];
-		}
+void indexRemove(ALIndex *index, void *data, unsigned long position)
+{
+	unsigned long mask = index->capacity - 1;
+	unsigned long i = hashOf(index, data) & mask;
 
-		free(list->array);
-		list->array = new;
-	} else {
-		for(i = start; i < list->size; i++)
+	while(index->entries[i].data)
+	{
+		if(index->entries[i].data == data && indexPosition(index, &index->entries[i]) == position)
+			break;
+		i = (i + 1) & mask;
+	}
+	if(!index->entries[i].data)
+		return;
+
+	unsigned long j = i;
+	for(;;)
+	{
+		index->entries[i].data = NULL;
+		for(;;)
 		{
-			list->array[i] = list->array[i+range];
+			j = (j + 1) & mask;
+			if(!index->entries[j].data)
+			{
+				index->count--;
+				return;
+			}
+			/* move the entry back unless its home lies cyclically in (i, j] */
+			unsigned long home = index->entries[j].hash & mask;
+			if(i <= j ? (i < home && home <= j) : (i < home || home <= j))
+				continue;
+			break;
 		}
+		index->entries[i] = index->entries[j];
+		i = j;
 	}
-	list->size -= range;
 }
 
-void increaseOne(AL *list, unsigned long index, void *data)
+int indexResize(ALIndex *index, unsigned long capacity)
 {
-	assert(ADD_THRESHOLD >= 1);
+	ALIndexEntry *old = index->entries;
+	unsigned long old_capacity = index->capacity;
 
-	if(index > list->size)
-		index = list->size;
+	indexRepair(index);
 
-	if(ADD_THRESHOLD * list->size >= list->memory_size)
+	ALIndexEntry *new = calloc(capacity, sizeof(ALIndexEntry));
+	if(!new)
+		return -1;
+
+	index->entries = new;
+	index->capacity = capacity;
+	index->count = 0;
+
+	unsigned long i;
+	for(i = 0; i < old_capacity; i++)
 	{
-		list->memory_size = list->size * ADD_SIZE_MULTIPLY_FACTOR;
-		void **new = malloc(sizeof(void *) * list->memory_size);
+		if(old[i].data)
+			indexInsert(index, old[i].data, old[i].hash, old[i].position);
+	}
+	free(old);
+	return 0;
+}
 
-		unsigned long i;
-		for(i = 0; i < index; i++)
+/*
+ * Record an element stored at the position. Elements inserted in front of
+ * others have to shift them first, see indexShift.
+ */
+void indexAppend(AL *list, void *data, unsigned long position)
+{
+	ALIndex *index = list->index;
+	if(!index || index->dirty || !data)
+		return;
+
+	if(2 * (index->count + 1) > index->capacity && indexResize(index, index->capacity * 2) < 0)
+	{
+		index->dirty = 1;
+		return;
+	}
+	indexInsert(index, data, hashOf(index, data), position);
+}
+
+/*
+ * Inserts and deletes inside the list shift the positions of all following
+ * elements. Instead of repairing all entries on every shift, the shifts are
+ * logged and applied to an entry when it is looked at. An entry only
+ * applies the shifts logged after it was inserted. When the log is full,
+ * all entries are repaired in one pass, which spreads the cost over
+ * INDEX_SHIFTS shifts.
+ */
+unsigned long indexPosition(ALIndex *index, ALIndexEntry *entry)
+{
+	unsigned long position = entry->position, i;
+	for(i = entry->shifts; i < index->shifts_count; i++)
+	{
+		if(position >= index->shifts[i].position)
+			position += index->shifts[i].delta;
+	}
+	return position;
+}
+
+void indexRepair(ALIndex *index)
+{
+	if(index->shifts_count == 0)
+		return;
+
+	unsigned long i;
+	for(i = 0; i < index->capacity; i++)
+	{
+		ALIndexEntry *entry = &index->entries[i];
+		if(entry->data)
 		{
-			new[i] = list->array[i];
+			entry->position = indexPosition(index, entry);
+			entry->shifts = 0;
 		}
-		new[index] = data;
-		for(i = index+1; i <= list->size; i++) // or list->size+1
+	}
+	index->shifts_count = 0;
+}
+
+/*
+ * Move the elements from position on by delta.
+ */
+void indexShift(AL *list, unsigned long position, long delta)
+{
+	ALIndex *index = list->index;
+	if(!index || index->dirty)
+		return;
+
+	if(index->shifts_count == INDEX_SHIFTS)
+		indexRepair(index);
+	index->shifts[index->shifts_count].position = position;
+	index->shifts[index->shifts_count].delta = delta;
+	index->shifts_count++;
+}
+
+/*
+ * Forget an element which is removed from the list, before the list
+ * shrinks.
+ */
+void indexDelete(AL *list, void *data, unsigned long position)
+{
+	ALIndex *index = list->index;
+	if(!index || index->dirty)
+		return;
+
+	if(data)
+		indexRemove(index, data, position);
+	if(position + 1 < list->size)
+		indexShift(list, position + 1, -1);
+}
+
+/*
+ * Changes which move many elements at once make the next lookup rebuild
+ * the index.
+ */
+void indexInvalidate(AL *list)
+{
+	if(list->index)
+		list->index->dirty = 1;
+}
+
+int indexRebuild(AL *list)
+{
+	ALIndex *index = list->index;
+
+	unsigned long capacity = INDEX_MIN_CAPACITY;
+	while(capacity < 2 * list->size)
+		capacity *= 2;
+
+	if(capacity != index->capacity)
+	{
+		ALIndexEntry *new = calloc(capacity, sizeof(ALIndexEntry));
+		if(!new)
+			return -1;
+		free(index->entries);
+		index->entries = new;
+		index->capacity = capacity;
+	}
+	else
+	{
+		memset(index->entries, 0, sizeof(ALIndexEntry) * capacity);
+	}
+	index->count = 0;
+	index->shifts_count = 0;
+
+	ALIter iter;
+	al_iterInit(list, &iter);
+	void *data;
+	unsigned long i;
+	for(i = 0; al_next(&iter, &data); i++)
+	{
+		if(data)
+			indexInsert(index, data, hashOf(index, data), i);
+	}
+	index->dirty = 0;
+	return 0;
+}
+
+/*
+ * Position of the first element equal to data or -1.
+ */
+long indexFind(AL *list, void *data)
+{
+	ALIndex *index = list->index;
+
+	if(index->dirty && indexRebuild(list) < 0)
+		return -2;
+
+	unsigned long hash = hashOf(index, data);
+	unsigned long mask = index->capacity - 1;
+	unsigned long i = hash & mask;
+	long found = -1;
+
+	while(index->entries[i].data)
+	{
+		ALIndexEntry *entry = &index->entries[i];
+		if(entry->hash == hash
+			&& (entry->data == data || (index->hashFn && list->compareFn(entry->data, data) == 0)))
 		{
-			new[i] = list->array[i-1];
+			unsigned long position = indexPosition(index, entry);
+			if(found < 0 || position < (unsigned long) found)
+				found = position;
 		}
-		free(list->array);
-		list->array = new;
-	} else {
-		unsigned long i;
+		i = (i + 1) & mask;
+	}
+	return found;
+}
+
+/*
+ * The tombstones of a lazily deleting list are a bitmap over the slots of
+ * the array, a set bit marks a deleted element. The slots in use are the
+ * size live elements and the dead ones, in list order. tree is a Fenwick
+ * tree over the number of tombstones per word of the bitmap (1-based), so
+ * an index is translated to its slot in O(log n).
+ */
+void treeAdd(ALTombstones *tombstones, unsigned long word, long delta)
+{
+	unsigned long i;
+	for(i = word + 1; i <= tombstones->words; i += i & -i)
+	{
+		tombstones->tree[i] += delta;
+	}
+}
+
+/*
+ * Make the bitmap cover at least slots slots. The new bits are clear.
+ */
+int tombstonesResize(ALTombstones *tombstones, unsigned long slots)
+{
+	unsigned long words = (slots + 63) / 64;
+	if(words <= tombstones->words)
+		return 0;
+	if(words < tombstones->words * 2)
+		words = tombstones->words * 2;
+
+	uint64_t *bits = realloc(tombstones->bits, sizeof(uint64_t) * words);
+	if(!bits)
+		return -1;
+	tombstones->bits = bits;
+	unsigned long *tree = realloc(tombstones->tree, sizeof(unsigned long) * (words + 1));
+	if(!tree)
+		return -1;
+	tombstones->tree = tree;
+
+	memset(bits + tombstones->words, 0, sizeof(uint64_t) * (words - tombstones->words));
+	tombstones->words = words;
+
+	/* rebuild the tree in linear time */
+	unsigned long i;
+	tree[0] = 0;
+	for(i = 1; i <= words; i++)
+	{
+		tree[i] = __builtin_popcountll(bits[i-1]);
+	}
+	for(i = 1; i <= words; i++)
+	{
+		unsigned long parent = i + (i & -i);
+		if(parent <= words)
+			tree[parent] += tree[i];
+	}
+	return 0;
+}
+
+/*
+ * Slot of the live element at the index (select over the clear bits).
+ */
+unsigned long slotOf(ALTombstones *tombstones, unsigned long index)
+{
+	unsigned long word = 0, step = 1;
+	while(step * 2 <= tombstones->words)
+		step *= 2;
+
+	/* find the word holding the element, each tree node covers step words */
+	for(; step; step /= 2)
+	{
+		if(word + step <= tombstones->words)
+		{
+			unsigned long live = 64 * step - tombstones->tree[word + step];
+			if(live <= index)
+			{
+				word += step;
+				index -= live;
+			}
+		}
+	}
+	/* slots behind the bitmap are live */
+	if(word == tombstones->words)
+		return word * 64 + index;
+
+	uint64_t live = ~tombstones->bits[word];
+	while(index--)
+	{
+		live &= live - 1;
+	}
+	return word * 64 + __builtin_ctzll(live);
+}
+
+/*
+ * Delete the element at the index by marking its slot. A deleted last slot
+ * is dropped together with the tombstones in front of it.
+ */
+void* bury(AL *list, unsigned long index)
+{
+	ALTombstones *tombstones = list->tombstones;
+	unsigned long slot = tombstones->dead ? slotOf(tombstones, index) : index;
+	void *data = list->array[slot];
+
+	if(slot + 1 < list->size + tombstones->dead && tombstonesResize(tombstones, slot + 1) < 0)
+	{
+		/* no memory for the bitmap, delete eagerly */
+		compact(list);
+		decreaseOne(list, index);
+		return data;
+	}
+
+	indexDelete(list, data, index);
+
+	list->size--;
+	if(slot == list->size + tombstones->dead)
+	{
+		while(slot > 0 && (slot-1) / 64 < tombstones->words && tombstones->bits[(slot-1) / 64] >> ((slot-1) % 64) & 1)
+		{
+			slot--;
+			tombstones->bits[slot / 64] &= ~(1ULL << (slot % 64));
+			treeAdd(tombstones, slot / 64, -1);
+			tombstones->dead--;
+		}
+	}
+	else
+	{
+		tombstones->bits[slot / 64] |= 1ULL << (slot % 64);
+		treeAdd(tombstones, slot / 64, 1);
+		tombstones->dead++;
+	}
+
+	if(tombstones->dead > tombstones->threshold * (list->size + tombstones->dead))
+		compact(list);
+	account(list, 0);
+	return data;
+}
+
+/*
+ * Move the live elements together, skipping runs of words without
+ * tombstones, and clear the bitmap. Shrinks the array like decreaseOne.
+ */
+void compact(AL *list)
+{
+	ALTombstones *tombstones = list->tombstones;
+	unsigned long slots = list->size + tombstones->dead;
+	unsigned long size = 0, word;
+
+	for(word = 0; word * 64 < slots; word++)
+	{
+		unsigned long start = word * 64;
+		unsigned long end = start + 64 < slots ? start + 64 : slots;
+		uint64_t dead = word < tombstones->words ? tombstones->bits[word] : 0;
+
+		if(!dead)
+		{
+			if(size != start)
+				memmove(list->array + size, list->array + start, sizeof(void *) * (end - start));
+			size += end - start;
+			continue;
+		}
+		unsigned long i;
+		for(i = start; i < end; i++)
+		{
+			if(!(dead >> (i - start) & 1))
+				list->array[size++] = list->array[i];
+		}
+	}
+	assert(size == list->size);
+	STAT(list, moved, size);
+
+	memset(tombstones->bits, 0, sizeof(uint64_t) * tombstones->words);
+	memset(tombstones->tree, 0, sizeof(unsigned long) * (tombstones->words + 1));
+	tombstones->dead = 0;
+
+	shrink(list);
+}
+
+/*
+ * Give back memory after elements were removed in bulk.
+ */
+void shrink(AL *list)
+{
+	if(DEL_THRESHOLD * list->size <= list->memory_size && list->memory_size > MIN_SIZE)
+	{
+		unsigned long memory_size = list->size * ADD_SIZE_MULTIPLY_FACTOR;
+		if(memory_size < MIN_SIZE)
+			memory_size = MIN_SIZE;
+		void **new = realloc(list->array, sizeof(void *) * memory_size);
+		if(new)
+		{
+			STAT(list, shrinks, 1);
+			STAT(list, bytes_allocated, sizeof(void *) * memory_size);
+			list->array = new;
+			list->memory_size = memory_size;
+		}
+	}
+	account(list, 0);
+}
+
+/*
+ * Operations which shift the elements work on a compacted dense array.
+ */
+void settle(AL *list)
+{
+	if(list->sparse)
+		densify(list);
+	if(list->tombstones && list->tombstones->dead)
+		compact(list);
+}
+
+/*
+ * A sparse list splits the index space into blocks of SPARSE_BLOCK_SIZE
+ * slots. A block holds a bitmap of its occupied slots and their values
+ * packed in slot order, so the value of a slot is found by the popcount
+ * of the bits in front of it. Empty blocks aren't allocated, which costs
+ * a pointer per block instead of per slot. The summary has a bit per
+ * allocated block, so iteration skips empty blocks 64 at a time.
+ * Unoccupied slots read as NULL and storing NULL frees a slot.
+ */
+void* sparseGet(ALSparse *sparse, unsigned long index)
+{
+	ALSparseBlock *block = sparse->blocks[index / SPARSE_BLOCK_SIZE];
+	uint64_t bit = 1ULL << (index % SPARSE_BLOCK_SIZE);
+
+	if(!block || !(block->bits & bit))
+		return NULL;
+	return block->values[__builtin_popcountll(block->bits & (bit - 1))];
+}
+
+/*
+ * Make room in the block table for size slots.
+ */
+int sparseReserve(ALSparse *sparse, unsigned long size)
+{
+	unsigned long blocks = (size + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE;
+	if(blocks <= sparse->blocks_size)
+		return 0;
+	if(blocks < sparse->blocks_size * 2)
+		blocks = sparse->blocks_size * 2;
+
+	ALSparseBlock **table = realloc(sparse->blocks, sizeof(ALSparseBlock *) * blocks);
+	if(!table)
+		return -1;
+	sparse->blocks = table;
+	memset(table + sparse->blocks_size, 0, sizeof(ALSparseBlock *) * (blocks - sparse->blocks_size));
+
+	unsigned long old_words = (sparse->blocks_size + 63) / 64, words = (blocks + 63) / 64;
+	uint64_t *summary = realloc(sparse->summary, sizeof(uint64_t) * words);
+	if(!summary)
+		return -1;
+	sparse->summary = summary;
+	memset(summary + old_words, 0, sizeof(uint64_t) * (words - old_words));
+
+	sparse->blocks_size = blocks;
+	return 0;
+}
+
+/*
+ * Store data in a slot, moving at most a block of values.
+ */
+void* sparseSet(ALSparse *sparse, unsigned long index, void *data)
+{
+	unsigned long b = index / SPARSE_BLOCK_SIZE;
+	ALSparseBlock *block = sparse->blocks[b];
+	uint64_t bit = 1ULL << (index % SPARSE_BLOCK_SIZE);
+	unsigned long count = block ? __builtin_popcountll(block->bits) : 0;
+	unsigned long rank = block ? __builtin_popcountll(block->bits & (bit - 1)) : 0;
+
+	if(block && (block->bits & bit))
+	{
+		void *old = block->values[rank];
+		if(data)
+		{
+			block->values[rank] = data;
+			return old;
+		}
+
+		memmove(block->values + rank, block->values + rank + 1, sizeof(void *) * (count - rank - 1));
+		block->bits &= ~bit;
+		sparse->count--;
+		if(!block->bits)
+		{
+			free(block);
+			sparse->blocks[b] = NULL;
+			sparse->summary[b / 64] &= ~(1ULL << (b % 64));
+		}
+		return old;
+	}
+
+	if(!data)
+		return NULL;
+
+	if(!block || count == block->capacity)
+	{
+		unsigned long capacity = count ? count * 2 : SPARSE_MIN_CAPACITY;
+		if(capacity > SPARSE_BLOCK_SIZE)
+			capacity = SPARSE_BLOCK_SIZE;
+		ALSparseBlock *new = realloc(block, sizeof(ALSparseBlock) + sizeof(void *) * capacity);
+		if(!new)
+		{
+			puts("ERROR: Out of memory");
+			return NULL;
+		}
+		if(!block)
+		{
+			new->bits = 0;
+			sparse->summary[b / 64] |= 1ULL << (b % 64);
+		}
+		new->capacity = capacity;
+		block = sparse->blocks[b] = new;
+	}
+
+	memmove(block->values + rank + 1, block->values + rank, sizeof(void *) * (count - rank));
+	block->values[rank] = data;
+	block->bits |= bit;
+	sparse->count++;
+	return NULL;
+}
+
+/*
+ * Switch a sparse list to a dense array of memory_size at least size.
+ */
+int densify(AL *list)
+{
+	ALSparse *sparse = list->sparse;
+	unsigned long memory_size = list->size > MIN_SIZE ? list->size : MIN_SIZE;
+
+	void **array = calloc(memory_size, sizeof(void *));
+	if(!array)
+	{
+		puts("ERROR: Out of memory");
+		return -1;
+	}
+
+	unsigned long b;
+	for(b = 0; b < sparse->blocks_size; b++)
+	{
+		ALSparseBlock *block = sparse->blocks[b];
+		if(!block)
+			continue;
+
+		uint64_t bits = block->bits;
+		unsigned long rank = 0;
+		while(bits)
+		{
+			array[b * SPARSE_BLOCK_SIZE + __builtin_ctzll(bits)] = block->values[rank++];
+			bits &= bits - 1;
+		}
+		free(block);
+	}
+	free(sparse->blocks);
+	free(sparse->summary);
+	free(sparse);
+
+	STAT(list, grows, 1);
+	STAT(list, bytes_allocated, sizeof(void *) * memory_size);
+	list->sparse = NULL;
+	list->array = array;
+	list->memory_size = memory_size;
+	STAT_PEAK(list);
+	pressure(list);
+	return 0;
+}
+
+/*
+ * The heap is a HEAP_ARITY-ary tree stored in the array, the children of i
+ * are HEAP_ARITY * i + 1 to HEAP_ARITY * i + HEAP_ARITY. A wider node halves
+ * the height of a binary heap and its children share a cache line.
+ * Elements are moved into a hole instead of swapped.
+ */
+void siftUp(AL *list, unsigned long index)
+{
+	void *data = list->array[index];
+
+	while(index > 0)
+	{
+		unsigned long parent = (index - 1) / HEAP_ARITY;
+		if(list->compareFn(list->array[parent], data) <= 0)
+			break;
+		list->array[index] = list->array[parent];
+		index = parent;
+	}
+	list->array[index] = data;
+}
+
+/*
+ * order 1 keeps the smallest element on top, -1 the largest.
+ */
+void siftDown(AL *list, unsigned long index, unsigned long size, int order)
+{
+	void *data = list->array[index];
+
+	for(;;)
+	{
+		unsigned long first = HEAP_ARITY * index + 1;
+		if(first >= size)
+			break;
+		unsigned long last = first + HEAP_ARITY < size ? first + HEAP_ARITY : size;
+
+		unsigned long best = first, i;
+		for(i = first + 1; i < last; i++)
+		{
+			if(order * list->compareFn(list->array[i], list->array[best]) < 0)
+				best = i;
+		}
+		if(order * list->compareFn(list->array[best], data) >= 0)
+			break;
+		list->array[index] = list->array[best];
+		index = best;
+	}
+	list->array[index] = data;
+}
+
+/*
+ * freeFn of the lists returned by the set operations, which share their
+ * elements with the input lists.
+ */
+void shared(void *data)
+{
+	(void) data;
+}
+
+/*
+ * First index from start whose element is not less than data (strict 0) or
+ * greater than data (strict 1). The distance is probed exponentially before
+ * the binary search, so skipping d elements costs O(log d) comparisons.
+ */
+unsigned long gallop(int (*compareFn)(void*, void*), AL *list, unsigned long start, void *data, int strict)
+{
+	unsigned long low = start, high = start, step = 1;
+
+	while(high < list->size && compareFn(at(list, high), data) < strict)
+	{
+		low = high + 1;
+		high = start + step;
+		step *= 2;
+	}
+	if(high > list->size)
+		high = list->size;
+
+	while(low < high)
+	{
+		unsigned long middle = low + (high - low) / 2;
+		if(compareFn(at(list, middle), data) < strict)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/*
+ * Append elements of list to out, which has room for them.
+ */
+void appendRange(AL *out, AL *list, unsigned long start, unsigned long end)
+{
+	/* copy the slots when they are the elements, read the others with at */
+	if(!list->map && !list->sparse && !(list->tombstones && list->tombstones->dead) && !out->index)
+	{
+		memcpy(out->array + out->size, list->array + start, sizeof(void *) * (end - start));
+		out->size += end - start;
+		return;
+	}
+
+	unsigned long i;
+	for(i = start; i < end; i++)
+	{
+		void *data = at(list, i);
+		indexAppend(out, data, out->size);
+		out->array[out->size++] = data;
+	}
+}
+
+/*
+ * Prepare the output of a set operation for up to size more elements.
+ */
+AL* setOutput(AL *a, AL *b, AL *out, unsigned long size)
+{
+	assert(a && b);
+	assert(a->compareFn);
+	assert(out != a && out != b);
+
+	int created = !out;
+	if(created)
+	{
+		out = al_create(MIN_SIZE);
+		if(!out)
+			return NULL;
+		out->compareFn = a->compareFn;
+		out->freeFn = shared;
+		out->printFn = a->printFn;
+	}
+
+	assert(!out->map);
+	settle(out);
+	if(reserve(out, out->size + size) < 0)
+	{
+		puts("ERROR: Out of memory");
+		if(created)
+		{
+			al_clear(out);
+			free(out);
+		}
+		return NULL;
+	}
+	return out;
+}
+
+BatchNode* batchNode(BatchPool *pool, unsigned long start, unsigned long length, void *data)
+{
+	BatchNode *node = &pool->nodes[pool->used++];
+
+	/* xorshift */
+	pool->seed ^= pool->seed << 13;
+	pool->seed ^= pool->seed >> 7;
+	pool->seed ^= pool->seed << 17;
+
+	node->left = NULL;
+	node->right = NULL;
+	node->priority = pool->seed;
+	node->start = start;
+	node->length = length;
+	node->data = data;
+	batchUpdate(node);
+	return node;
+}
+
+/* a node holds length elements of the old array or one new element */
+void batchUpdate(BatchNode *node)
+{
+	node->size = (node->length ? node->length : 1)
+		+ (node->left ? node->left->size : 0)
+		+ (node->right ? node->right->size : 0);
+}
+
+BatchNode* batchMerge(BatchNode *left, BatchNode *right)
+{
+	if(!left)
+		return right;
+	if(!right)
+		return left;
+
+	if(left->priority > right->priority)
+	{
+		left->right = batchMerge(left->right, right);
+		batchUpdate(left);
+		return left;
+	}
+	right->left = batchMerge(left, right->left);
+	batchUpdate(right);
+	return right;
+}
+
+/*
+ * Split off the first count elements. A run containing the split point is
+ * cut in two nodes.
+ */
+void batchSplit(BatchPool *pool, BatchNode *node, unsigned long count, BatchNode **left, BatchNode **right)
+{
+	if(!node)
+	{
+		*left = NULL;
+		*right = NULL;
+		return;
+	}
+
+	unsigned long before = node->left ? node->left->size : 0;
+	unsigned long own = node->length ? node->length : 1;
+
+	if(count <= before)
+	{
+		batchSplit(pool, node->left, count, left, &node->left);
+		batchUpdate(node);
+		*right = node;
+	}
+	else if(count >= before + own)
+	{
+		batchSplit(pool, node->right, count - before - own, &node->right, right);
+		batchUpdate(node);
+		*left = node;
+	}
+	else
+	{
+		unsigned long cut = count - before;
+		BatchNode *tail = batchNode(pool, node->start + cut, node->length - cut, NULL);
+		node->length = cut;
+		*right = batchMerge(tail, node->right);
+		node->right = NULL;
+		batchUpdate(node);
+		*left = node;
+	}
+}
+
+void batchCollect(BatchNode *node, void **old, void **new, unsigned long *size)
+{
+	if(!node)
+		return;
+
+	batchCollect(node->left, old, new, size);
+	if(node->length)
+	{
+		memcpy(new + *size, old + node->start, sizeof(void *) * node->length);
+		*size += node->length;
+	}
+	else
+	{
+		new[(*size)++] = node->data;
+	}
+	batchCollect(node->right, old, new, size);
+}
+
+/*
+ * Bytes which shrink-to-fit would give back. Slots of tombstones are in use.
+ */
+unsigned long slack(AL *list)
+{
+	unsigned long used = list->size + (list->tombstones ? list->tombstones->dead : 0);
+	if(used < MIN_SIZE)
+		used = MIN_SIZE;
+	return list->memory_size > used ? sizeof(void *) * (list->memory_size - used) : 0;
+}
+
+int compareSlack(const void *a, const void *b)
+{
+	unsigned long x = slack(*(AL * const *) a), y = slack(*(AL * const *) b);
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/*
+ * Give back up to bytes of the slack of the list. The caller holds the
+ * registry lock.
+ */
+unsigned long trimList(AL *list, unsigned long bytes)
+{
+	unsigned long free_bytes = slack(list);
+	if(free_bytes > bytes)
+		free_bytes = bytes;
+	free_bytes -= free_bytes % sizeof(void *);
+	if(free_bytes == 0)
+		return 0;
+
+	unsigned long memory_size = list->memory_size - free_bytes / sizeof(void *);
+	void **new = realloc(list->array, sizeof(void *) * memory_size);
+	if(!new)
+		return 0;
+	STAT(list, shrinks, 1);
+	STAT(list, bytes_allocated, sizeof(void *) * memory_size);
+	list->array = new;
+	list->memory_size = memory_size;
+	accountLocked(list);
+	return free_bytes;
+}
+
+/*
+ * Shrink the lists with the most slack first to fit until at most bytes
+ * are reserved.
+ */
+unsigned long trimLocked(unsigned long bytes)
+{
+	if(registry.reserved <= bytes)
+		return 0;
+
+	AL **lists = malloc(sizeof(AL *) * registry.size);
+	if(!lists)
+		return 0;
+	memcpy(lists, registry.lists, sizeof(AL *) * registry.size);
+	qsort(lists, registry.size, sizeof(AL *), compareSlack);
+
+	unsigned long trimmed = 0, i;
+	for(i = 0; i < registry.size && registry.reserved > bytes; i++)
+	{
+		if(slack(lists[i]) == 0)
+			break;
+		trimmed += trimList(lists[i], slack(lists[i]));
+	}
+	free(lists);
+
+	registry.trims++;
+	registry.trimmed += trimmed;
+	return trimmed;
+}
+
+/*
+ * Update the bytes the registry counts for the list. Only the list itself
+ * reports its size, the registry never reads the arrays of other lists.
+ */
+void accountLocked(AL *list)
+{
+	unsigned long reserved = sizeof(void *) * list->memory_size;
+	registry.reserved += reserved - list->reserved;
+	list->reserved = reserved;
+	__atomic_store_n(&registry.over, registry.budget && registry.reserved > registry.budget, __ATOMIC_RELAXED);
+}
+
+/*
+ * Report the size of a registered list after it changed. While the budget
+ * is exceeded, the list gives back its own slack until the registry is down
+ * to REGISTRY_LOW_WATER of the budget. The list keeps 1/REGISTRY_HEADROOM
+ * of its size to grow into, and removals only trim once the slack is twice
+ * that, otherwise every push or pop would reallocate. Other lists are never
+ * touched: their iterators and spans stay valid, and lists of different
+ * threads don't race.
+ */
+void account(AL *list, int growing)
+{
+	if(__atomic_load_n(&list->registered, __ATOMIC_RELAXED) < 0)
+		return;
+
+	unsigned long headroom = sizeof(void *) * (list->size / REGISTRY_HEADROOM);
+	unsigned long free_bytes = slack(list);
+	int over = __atomic_load_n(&registry.over, __ATOMIC_RELAXED);
+	if(!growing && list->reserved == sizeof(void *) * list->memory_size
+		&& (!over || free_bytes <= 2 * headroom))
+		return;
+
+	pthread_mutex_lock(&registry_lock);
+	accountLocked(list);
+	if(registry.over && free_bytes > (growing ? headroom : 2 * headroom))
+	{
+		unsigned long low_water = registry.budget * REGISTRY_LOW_WATER;
+		unsigned long bytes = registry.reserved - low_water;
+		if(bytes > free_bytes - headroom)
+			bytes = free_bytes - headroom;
+		unsigned long trimmed = trimList(list, bytes);
+		if(trimmed)
+		{
+			registry.trims++;
+			registry.trimmed += trimmed;
+		}
+	}
+	pthread_mutex_unlock(&registry_lock);
+}
+
+/*
+ * Called after a list grew.
+ */
+void pressure(AL *list)
+{
+	account(list, 1);
+}
+
+/*
+ * Make room for at least size elements without changing the list.
+ */
+int reserve(AL *list, unsigned long size)
+{
+	if(size <= list->memory_size)
+		return 0;
+	if(size < list->memory_size * ADD_SIZE_MULTIPLY_FACTOR)
+		size = list->memory_size * ADD_SIZE_MULTIPLY_FACTOR;
+
+	void **new = realloc(list->array, sizeof(void *) * size);
+	if(!new)
+		return -1;
+
+	STAT(list, grows, 1);
+	STAT(list, moved, list->size);
+	STAT(list, bytes_allocated, sizeof(void *) * size);
+	list->array = new;
+	list->memory_size = size;
+	STAT_PEAK(list);
+	pressure(list);
+	return 0;
+}
+
+/* memchr is vectorized by the C library, far faster than a byte loop */
+unsigned long countLines(const char *text, unsigned long length)
+{
+	const char *end = text + length;
+	unsigned long lines = 0;
+
+	while(text < end && (text = memchr(text, '\n', end - text)))
+	{
+		text++;
+		lines++;
+	}
+	return lines;
+}
+
+/*
+ * Parse all lines of the text and append the elements. The caller reserves
+ * the memory. A last line without newline is parsed as well.
+ */
+unsigned long parseLines(AL *list, const char *text, unsigned long length, void* (*parseFn)(const char*, unsigned long))
+{
+	const char *end = text + length;
+	unsigned long count = 0;
+
+	while(text < end)
+	{
+		const char *eol = memchr(text, '\n', end - text);
+		if(!eol)
+			eol = end;
+
+		unsigned long n = eol - text;
+		if(n > 0 && text[n-1] == '\r')
+			n--;
+		if(n > 0)
+		{
+			void *data = parseFn(text, n);
+			if(data)
+			{
+				indexAppend(list, data, list->size);
+				list->array[list->size++] = data;
+				count++;
+			}
+		}
+		text = eol + 1;
+	}
+	return count;
+}
+
+void increase(AL *list, unsigned long start, unsigned long size, void** data)
+{
+	assert(ADD_THRESHOLD >= 1);
+
+	if(start > list->size)
+		start = list->size;
+
+	unsigned long i;
+	if(start < list->size)
+		indexShift(list, start, size);
+	for(i = 0; i < size; i++)
+	{
+		indexAppend(list, data[i], start + i);
+	}
+
+	if(ADD_THRESHOLD * (list->size+size) >= list->memory_size)
+	{
+		list->memory_size = (list->size+size) * ADD_SIZE_MULTIPLY_FACTOR;
+		void **new = malloc(sizeof(void *) * list->memory_size);
+		STAT(list, grows, 1);
+		STAT(list, moved, list->size + size);
+		STAT(list, bytes_allocated, sizeof(void *) * list->memory_size);
+		STAT_PEAK(list);
+
+		unsigned long i;
+		for(i = 0; i < start; i++)
+		{
+			new[i] = list->array[i];
+		}
+		for(i = 0; i < size; i++)
+		{
+			new[i+start] = data[i];
+		}
+		for(i = start; i < list->size; i++)
+		{
+			new[i+size] = list->array[i];
+		}
+		free(list->array);
+		list->array = new;
+		pressure(list);
+	} else {
+		STAT(list, moved, list->size - start + size);
+		unsigned long i;
+		for(i = list->size; i > start; i--)
+		{
+			list->array[i-1+size] = list->array[i-1];
+		}
+		for(i = 0; i < size; i++)
+		{
+			list->array[i+start] = data[i];
+		}
+	}
+	list->size += size;
+
+	free(data);
+	data = NULL;
+}
+
+void decrease(AL *list, unsigned long start, unsigned long end)
+{
+	assert(list);
+	assert(start <= end);
+	assert(end < list->size);
+
+	unsigned long range = end-start+1;
+	unsigned long i;
+	if(list->index && !list->index->dirty)
+	{
+		for(i = start; i <= end; i++)
+		{
+			if(list->array[i])
+				indexRemove(list->index, list->array[i], i);
+		}
+		if(end + 1 < list->size)
+			indexShift(list, end + 1, -(long) range);
+	}
+	for(i = start; i <= end; i++)
+	{
+		list->freeFn(list->array[i]);
+	}
+	STAT(list, frees, range);
+
+	if(DEL_THRESHOLD * (list->size-range) <= list->memory_size && list->size >= MIN_SIZE)
+	{
+		list->memory_size /= DEL_SIZE_DIVIDE_FACTOR;
+		void **new = malloc(sizeof(void *) * list->memory_size);
+		STAT(list, shrinks, 1);
+		STAT(list, moved, list->size - range);
+		STAT(list, bytes_allocated, sizeof(void *) * list->memory_size);
+
+		unsigned long i;
+		for(i = 0; i < start; i++)
+		{
+			new[i] = list->array[i];
+		}
+		for(i = start; i < list->size-range; i++)
+		{
+			new[i] = list->array[i+range];
+		}
+
+		free(list->array);
+		list->array = new;
+	} else {
+		STAT(list, moved, list->size - range - start);
+		for(i = start; i < list->size-range; i++)
+		{
+			list->array[i] = list->array[i+range];
+		}
+	}
+	list->size -= range;
+	account(list, 0);
+}
+
+void increaseOne(AL *list, unsigned long index, void *data)
+{
+	assert(ADD_THRESHOLD >= 1);
+
+	if(index > list->size)
+		index = list->size;
+
+	if(index < list->size)
+		indexShift(list, index, 1);
+	indexAppend(list, data, index);
+
+	if(ADD_THRESHOLD * list->size >= list->memory_size)
+	{
+		list->memory_size = list->size * ADD_SIZE_MULTIPLY_FACTOR;
+		void **new = malloc(sizeof(void *) * list->memory_size);
+		STAT(list, grows, 1);
+		STAT(list, moved, list->size + 1);
+		STAT(list, bytes_allocated, sizeof(void *) * list->memory_size);
+		STAT_PEAK(list);
+
+		unsigned long i;
+		for(i = 0; i < index; i++)
+		{
+			new[i] = list->array[i];
+		}
+		new[index] = data;
+		for(i = index+1; i <= list->size; i++) // or list->size+1
+		{
+			new[i] = list->array[i-1];
+		}
+		free(list->array);
+		list->array = new;
+		pressure(list);
+	} else {
+		STAT(list, moved, list->size - index + 1);
+		unsigned long i;
 		for(i = list->size; i > index; i--)
 		{
-			list->array[i] = list->array[i-1];
+			list->array[i] = list->array[i-1];
+		}
+		list->array[index] = data;
+	}
+	list->size++;
+}
+
+void decreaseOne(AL *list, unsigned long index)
+{
+	indexDelete(list, list->array[index], index);
+
+	if(DEL_THRESHOLD * list->size <= list->memory_size && list->size >= MIN_SIZE)
+	{
+		list->memory_size /= DEL_SIZE_DIVIDE_FACTOR;
+		void **new = malloc(sizeof(void *) * list->memory_size);
+		STAT(list, shrinks, 1);
+		STAT(list, moved, list->size - 1);
+		STAT(list, bytes_allocated, sizeof(void *) * list->memory_size);
+
+		unsigned long i;
+		for(i = 0; i < index; i++)
+		{
+			new[i] = list->array[i];
+		}
+		// list->size--;
+		for(i = index+1; i <= list->size; i++)
+		{
+			new[i-1] = list->array[i];
+		}
+
+		free(list->array);
+		list->array = new;
+	} else {
+		STAT(list, moved, list->size - index - 1);
+		unsigned long i;
+		for(i = index; i < list->size-1; i++)
+		{
+			list->array[i] = list->array[i+1];
+		}
+		//list->array[i] = NULL;
+	}
+	list->size--;
+	account(list, 0);
+}
+
+/*
+ * Set up the fields of a new array list. Everything which isn't given is
+ * zero or NULL, so a field added to AL only needs a line here if it starts
+ * out differently.
+ */
+void init(AL *list, void **array, unsigned long size, unsigned long memory_size)
+{
+	memset(list, 0, sizeof(AL));
+	list->array = array;
+	list->size = size;
+	list->memory_size = memory_size;
+	list->registered = -1;
+#ifdef AL_STATS
+	list->stats.bytes_allocated = sizeof(void *) * memory_size;
+	list->stats.peak_memory_size = memory_size;
+#endif
+}
+
+/*
+ * Create an array list.
+ *
+ * @param unsigned int initial size of the array list
+ *
+ * @return AL pointer to the created array list
+ */
+AL* al_create(unsigned int size)
+{
+	assert(size > 0);
+	
+	AL *new = malloc(sizeof(AL));
+	void **array = malloc(sizeof(void *) * size);
+
+	if(new && array)
+	{
+		init(new, array, 0, size);
+		if(__atomic_load_n(&registry.track, __ATOMIC_RELAXED))
+			al_register(new);
+	}
+	else
+	{
+		puts("ERROR: Out of memory");
+		free(new);
+		free(array);
+		new = NULL;
+	}
+
+	return new;
+}
+
+/*
+ * Create a sparse array list of size empty (NULL) slots, for lists which
+ * are mostly NULL. Memory is used for the occupied slots, al_get and
+ * al_set stay O(1) and al_nextOccupied skips the empty slots. Once more
+ * than threshold of the slots are occupied, or an operation which shifts
+ * elements (like al_add or al_del) is called, the list switches to a
+ * dense array for good.
+ *
+ * @param unsigned long initial size of the array list
+ * @param double fraction of occupied slots which switches to dense (0 to 1)
+ *
+ * @return AL pointer to the created array list or NULL on failure
+ */
+AL* al_createSparse(unsigned long size, double threshold)
+{
+	assert(threshold >= 0 && threshold <= 1);
+
+	AL *list = malloc(sizeof(AL));
+	ALSparse *sparse = calloc(1, sizeof(ALSparse));
+	if(!list || !sparse || sparseReserve(sparse, size > MIN_SIZE ? size : MIN_SIZE) < 0)
+	{
+		puts("ERROR: Out of memory");
+		if(sparse)
+		{
+			free(sparse->blocks);
+			free(sparse->summary);
+		}
+		free(sparse);
+		free(list);
+		return NULL;
+	}
+	sparse->threshold = threshold;
+
+	init(list, NULL, size, 0);
+	list->sparse = sparse;
+	if(__atomic_load_n(&registry.track, __ATOMIC_RELAXED))
+		al_register(list);
+
+	return list;
+}
+
+/*
+ * Access an element of the array list.
+ *
+ * @param AL pointer to the array list
+ * @param unsigned long index
+ *
+ * @return void pointer to the element or NULL if it doesn't exist
+ */
+void* al_get(AL *list, unsigned long index)
+{
+	assert(list);
+	LATENCY_START;
+
+	void *data = index < list->size ? at(list, index) : NULL;
+
+	LATENCY_END(list, AL_OP_GET);
+	return data;
+}
+
+/*
+ * Access an element of the array list.
+ *
+ * @param AL pointer to the array list
+ * @param unsigned long index
+ *
+ * @return void pointer to the element or NULL if it doesn't exist
+ */
+void** al_range(AL *list, unsigned long start, unsigned long end)
+{
+	assert(list);
+	assert(start < end);
+
+	settle(list);
+
+	unsigned long size = end - start;
+	void **range = malloc(sizeof(void *) * size);
+
+	unsigned long i;
+	for(i = 0; start < end; i++)
+	{
+		range[i] = list->array[i+start++];
+	}
+
+	return range;
+}
+
+/*
+ * Change an element in the array list.
+ *
+ * @param AL pointer to the array list
+ * @param unsigned long index
+ * @param void pointer with the new data
+ *
+ * @return void pointer to the removed data if successfully changed or NULL if it doesn't exist
+ */
+void* al_set(AL *list, unsigned long index, void *data)
+{
+	assert(list);
+	assert(!list->map);
+	LATENCY_START;
+
+	void* old = NULL;
+	if(index < list->size && list->sparse)
+	{
+		old = sparseSet(list->sparse, index, data);
+		if(list->index && !list->index->dirty && old)
+			indexRemove(list->index, old, index);
+		indexAppend(list, data, index);
+		if(list->sparse->count > list->sparse->threshold * list->size)
+			densify(list);
+	}
+	else if(index < list->size)
+	{
+		unsigned long slot = list->tombstones && list->tombstones->dead ? slotOf(list->tombstones, index) : index;
+		old = list->array[slot];
+		list->array[slot] = data;
+		if(list->index && !list->index->dirty && old)
+			indexRemove(list->index, old, index);
+		indexAppend(list, data, index);
+	}
+
+	LATENCY_END(list, AL_OP_SET);
+	return old;
+}
+
+/*
+ * Push an element to the array list.
+ *
+ * @param AL pointer to the array list
+ * @param void pointer to the data
+ *
+ * @return unsigned long index of the inserted element
+ */
+unsigned long al_push(AL *list, void *data)
+{
+	assert(list);
+	assert(data);
+	assert(list->array || list->sparse);
+	LATENCY_START;
+
+	if(list->sparse)
+	{
+		if(sparseReserve(list->sparse, list->size + 1) == 0)
+		{
+			indexAppend(list, data, list->size);
+			sparseSet(list->sparse, list->size, data);
+			list->size++;
+			if(list->sparse->count > list->sparse->threshold * list->size)
+				densify(list);
+		}
+		else
+		{
+			puts("ERROR: Out of memory");
+		}
+	}
+	else if(list->tombstones && list->tombstones->dead)
+	{
+		/* append behind the tombstones */
+		unsigned long slot = list->size + list->tombstones->dead;
+		if(reserve(list, slot + 1) == 0)
+		{
+			indexAppend(list, data, list->size);
+			list->array[slot] = data;
+			list->size++;
+		}
+		else
+		{
+			puts("ERROR: Out of memory");
+		}
+	}
+	else
+	{
+		increaseOne(list, list->size, data);
+	}
+
+	LATENCY_END(list, AL_OP_PUSH);
+	return list->size;
+}
+
+/*
+ * Pop an element from the array list.
+ *
+ * @param AL pointer to the array list
+ * @param void pointer to the data
+ *
+ * @return void pointer to the removed data (not freed) or NULL if it doesn't exist
+ */
+void* al_pop(AL *list)
+{
+	assert(list);
+	assert(!list->map);
+	LATENCY_START;
+
+	void* old = NULL;
+	if(list->size > 0)
+	{
+		unsigned long last = list->size-1;
+		if(list->sparse)
+		{
+			old = sparseSet(list->sparse, last, NULL);
+			if(list->index && !list->index->dirty && old)
+				indexRemove(list->index, old, last);
+			list->size--;
+		}
+		else if(list->tombstones)
+		{
+			old = bury(list, last);
+		}
+		else
+		{
+			old = list->array[last];
+			decreaseOne(list, last);
+		}
+	}
+
+	LATENCY_END(list, AL_OP_POP);
+	return old;
+}
+
+/*
+ * Add an element to the array list.
+ *
+ * @param AL pointer to the array list
+ * @param unsingend long index
+ * @param void pointer to the data
+ *
+ * @return unsigned long index of the inserted element
+ */
+unsigned long al_add(AL *list, unsigned long index, void *data)
+{
+	assert(list);
+	assert(data);
+	assert(list->array || list->sparse);
+	LATENCY_START;
+
+	settle(list);
+	increaseOne(list, index, data);
+
+	LATENCY_END(list, AL_OP_ADD);
+	return list->size;
+}
+
+/*
+ * Remove an element of the array list at a specific index.
+ *
+ * @param AL pointer to the array list
+ * @param unsingend long index
+ *
+ * @return void pointer to the removed data (not freed) or NULL if it doesn't exist
+ */
+void* al_del(AL *list, unsigned long index)
+{
+	assert(list);
+	assert(!list->map);
+	LATENCY_START;
+
+	void *old = NULL;
+	if(list->sparse)
+		settle(list);
+	if(index < list->size && list->tombstones)
+	{
+		old = bury(list, index);
+	}
+	else if(index < list->size)
+	{
+		old = list->array[index];
+
+		decreaseOne(list, index);
+	}
+
+	LATENCY_END(list, AL_OP_DEL);
+	return old;
+}
+
+/*
+ * Add an array of void pointers to the array list.
+ *
+ * @param AL pointer to the array list
+ * @param void pointer to the array
+ *
+ * @return void
+ */
+void al_addAll(AL *list, unsigned int data_size, void **data)
+{
+	assert(list);
+	assert(data);
+	assert(list->array || list->sparse);
+	LATENCY_START;
+
+	settle(list);
+	increase(list, list->size, data_size, data);
+
+	LATENCY_END(list, AL_OP_ADD_ALL);
+
+	// printf("Add %d\n", *(int *)data);
+	// al_print(list);
+	// printf("size %ld\n", list->size);
+	// printf("memory_size %ld\n", list->memory_size);
+}
+
+void al_delRange(AL *list, unsigned long start, unsigned long end)
+{
+	LATENCY_START;
+
+	settle(list);
+	decrease(list, start, end);
+
+	LATENCY_END(list, AL_OP_DEL_RANGE);
+}
+
+/*
+ * Reverse the array list.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return void
+ */
+void al_reverse(AL *list)
+{
+	assert(list);
+
+	LATENCY_START;
+	settle(list);
+	indexInvalidate(list);
+
+	unsigned long i = 0, j = list->size;
+	void *tmp;
+
+	while(i < j)
+	{
+		j--;
+//		printf("i = %ld, j = %ld\n", i, j);
+//		printf("left: %p, right: %p\n", list->array[i], list->array[j]);
+		tmp = list->array[i];
+		list->array[i] = list->array[j];
+		list->array[j] = tmp;
+//		printf("left: %p, right: %p\n", list->array[i], list->array[j]);
+		i++;
+	}
+
+	LATENCY_END(list, AL_OP_REVERSE);
+}
+
+/*
+ * Deallocate memory of the array list.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return void
+ */
+void al_clear(AL *list)
+{
+	assert(list);
+
+	al_unregister(list);
+
+	if(list->map)
+	{
+		munmap(list->map->addr, list->map->length);
+		free(list->map);
+		list->map = NULL;
+		list->size = 0;
+		return;
+	}
+
+	LATENCY_START;
+	STAT(list, frees, list->size);
+	al_indexDestroy(list);
+	al_lazyDelete(list, 0);
+
+	if(list->sparse)
+	{
+		unsigned long b;
+		for(b = 0; b < list->sparse->blocks_size; b++)
+		{
+			ALSparseBlock *block = list->sparse->blocks[b];
+			if(!block)
+				continue;
+			unsigned long i, count = __builtin_popcountll(block->bits);
+			for(i = 0; i < count; i++)
+			{
+				list->freeFn(block->values[i]);
+			}
+			free(block);
+		}
+		free(list->sparse->blocks);
+		free(list->sparse->summary);
+		free(list->sparse);
+		list->sparse = NULL;
+		list->size = 0;
+	}
+
+	while(list->size)
+	{
+		list->size--;
+		list->freeFn(list->array[list->size]);
+		list->array[list->size] = NULL;
+	}
+	free(list->array);
+	list->array = NULL;
+	// list->size = 0;
+	list->memory_size = 0;
+
+	LATENCY_END(list, AL_OP_CLEAR);
+}
+
+/*
+ * Print the array list to the console.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return void
+ */
+void al_print(AL *list)
+{
+	assert(list);
+	assert(list->printFn);
+
+	unsigned long i;
+	if(list->sparse)
+	{
+		long next;
+		for(next = al_nextOccupied(list, 0); next >= 0; next = al_nextOccupied(list, next + 1))
+		{
+			printf("index: %ld data: ", next);
+			list->printFn(at(list, next));
+		}
+	}
+	else
+	{
+		ALIter iter;
+		al_iterInit(list, &iter);
+		void *data;
+		for(i = 0; al_next(&iter, &data); i++)
+		{
+			printf("index: %ld data: ", i);
+			list->printFn(data);
+		}
+	}
+	puts("---");
+}
+
+/*
+ * Save the array list to a file in the binary snapshot format.
+ * The file descriptor has to be seekable, the snapshot is written at its
+ * current position which is left at the end of the snapshot.
+ *
+ * serializeFn writes an element to a buffer of the given size and returns
+ * the length of the payload. If the payload doesn't fit, it returns the
+ * required length and is called again with a big enough buffer.
+ *
+ * @param AL pointer to the array list
+ * @param int file descriptor
+ * @param function pointer to the serialize callback
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int al_save(AL *list, int fd, unsigned long (*serializeFn)(void*, void*, unsigned long))
+{
+	assert(list);
+	assert(serializeFn);
+
+	off_t base = lseek(fd, 0, SEEK_CUR);
+	if(base < 0)
+		return -1;
+
+	unsigned long table_size = sizeof(uint64_t) * (list->size + 1);
+	off_t data = base + sizeof(SnapshotHeader) + table_size;
+	if(lseek(fd, data, SEEK_SET) < 0)
+		return -1;
+
+	uint64_t *table = malloc(table_size);
+	unsigned long buffer_size = SNAPSHOT_BUFFER_SIZE, used = 0;
+	char *buffer = malloc(buffer_size);
+	if(!table || !buffer)
+	{
+		free(table);
+		free(buffer);
+		return -1;
+	}
+
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(SnapshotHeader));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.size = list->size;
+	header.data_checksum = CHECKSUM_INIT;
+
+	int uniform = 1;
+	unsigned long i;
+	for(i = 0; i < list->size; i++)
+	{
+		void *element = at(list, i);
+		unsigned long n;
+		while((n = serializeFn(element, buffer + used, buffer_size - used)) > buffer_size - used)
+		{
+			if(used)
+			{
+				if(writeAll(fd, buffer, used) < 0)
+					goto fail;
+				used = 0;
+			}
+			else
+			{
+				char *new = realloc(buffer, n);
+				if(!new)
+					goto fail;
+				buffer = new;
+				buffer_size = n;
+			}
+		}
+		header.data_checksum = checksum(header.data_checksum, buffer + used, n);
+
+		table[i] = header.data_size;
+		if(i == 0)
+			header.stride = n;
+		else if(n != header.stride)
+			uniform = 0;
+		header.data_size += n;
+		used += n;
+	}
+	table[list->size] = header.data_size;
+	if(!uniform)
+		header.stride = 0;
+
+	if(writeAll(fd, buffer, used) < 0)
+		goto fail;
+
+	header.table_checksum = checksum(CHECKSUM_INIT, table, table_size);
+	header.header_checksum = headerChecksum(header);
+
+	if(pwriteAll(fd, table, table_size, base + sizeof(SnapshotHeader)) < 0)
+		goto fail;
+	if(pwriteAll(fd, &header, sizeof(SnapshotHeader), base) < 0)
+		goto fail;
+
+	free(table);
+	free(buffer);
+	return 0;
+
+fail:
+	free(table);
+	free(buffer);
+	return -1;
+}
+
+/*
+ * Load an array list from a binary snapshot, verifying all checksums.
+ *
+ * deserializeFn creates an element from a payload and its length.
+ * The freeFn of the returned array list is free, the other callbacks are
+ * not set.
+ *
+ * @param int file descriptor positioned at the snapshot
+ * @param function pointer to the deserialize callback
+ *
+ * @return AL pointer to the loaded array list or NULL on failure
+ */
+AL* al_load(int fd, void* (*deserializeFn)(const void*, unsigned long))
+{
+	assert(deserializeFn);
+
+	SnapshotHeader header;
+	if(readAll(fd, &header, sizeof(SnapshotHeader)) < 0
+		|| header.magic != SNAPSHOT_MAGIC
+		|| header.version != SNAPSHOT_VERSION
+		|| header.header_checksum != headerChecksum(header)
+		|| header.size >= (unsigned long) -1 / sizeof(uint64_t))
+	{
+		puts("ERROR: Invalid snapshot");
+		return NULL;
+	}
+
+	unsigned long table_size = sizeof(uint64_t) * (header.size + 1);
+	uint64_t *table = malloc(table_size);
+	char *data = malloc(header.data_size ? header.data_size : 1);
+	AL *list = NULL;
+
+	if(!table || !data)
+	{
+		puts("ERROR: Out of memory");
+		goto done;
+	}
+	if(readAll(fd, table, table_size) < 0
+		|| checksum(CHECKSUM_INIT, table, table_size) != header.table_checksum
+		|| table[header.size] != header.data_size
+		|| readAll(fd, data, header.data_size) < 0
+		|| checksum(CHECKSUM_INIT, data, header.data_size) != header.data_checksum)
+	{
+		puts("ERROR: Invalid snapshot");
+		goto done;
+	}
+
+	unsigned long i;
+	for(i = 0; i < header.size; i++)
+	{
+		if(table[i] > table[i+1])
+		{
+			puts("ERROR: Invalid snapshot");
+			goto done;
+		}
+	}
+
+	list = al_create(MIN_SIZE);
+	if(!list)
+		goto done;
+	if(reserve(list, header.size) < 0)
+	{
+		puts("ERROR: Out of memory");
+		al_clear(list);
+		free(list);
+		list = NULL;
+		goto done;
+	}
+	list->freeFn = free;
+	for(i = 0; i < header.size; i++)
+	{
+		list->array[i] = deserializeFn(data + table[i], table[i+1] - table[i]);
+	}
+	list->size = header.size;
+
+done:
+	free(table);
+	free(data);
+	return list;
+}
+
+/*
+ * Map a binary snapshot read-only. al_get returns pointers to the payloads
+ * inside the mapping, so only the pages which are read are touched. The
+ * returned array list can't be modified, al_clear unmaps it.
+ * The snapshot has to start at the beginning of the file, i.e. al_save was
+ * called on a file descriptor at offset 0. The offset table is verified
+ * once, the payloads are not.
+ *
+ * @param const char pointer to the file name
+ *
+ * @return AL pointer to the mapped array list or NULL on failure
+ */
+AL* al_mapReadOnly(const char *path)
+{
+	assert(path);
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (unsigned long) st.st_size < sizeof(SnapshotHeader))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED)
+		return NULL;
+
+	SnapshotHeader *header = addr;
+	unsigned long length = st.st_size;
+	unsigned long table_size = sizeof(uint64_t) * (header->size + 1);
+	if(header->magic != SNAPSHOT_MAGIC
+		|| header->version != SNAPSHOT_VERSION
+		|| header->header_checksum != headerChecksum(*header)
+		|| header->size >= length / sizeof(uint64_t)
+		|| header->data_size > length
+		|| sizeof(SnapshotHeader) + table_size + header->data_size > length
+		|| mapInvalid(header))
+	{
+		puts("ERROR: Invalid snapshot");
+		munmap(addr, st.st_size);
+		return NULL;
+	}
+
+	AL *list = malloc(sizeof(AL));
+	ALMap *map = malloc(sizeof(ALMap));
+	if(!list || !map)
+	{
+		puts("ERROR: Out of memory");
+		free(list);
+		free(map);
+		munmap(addr, st.st_size);
+		return NULL;
+	}
+
+	map->addr = addr;
+	map->length = st.st_size;
+	map->stride = header->stride;
+	map->offsets = (const uint64_t *) ((char *) addr + sizeof(SnapshotHeader));
+	map->data = (const char *) map->offsets + table_size;
+
+	init(list, NULL, header->size, 0);
+	list->map = map;
+
+	return list;
+}
+
+/*
+ * Parse a decimal integer without locale or errno overhead. Leading blanks
+ * and a sign are accepted.
+ *
+ * @param const char pointer to the text
+ * @param unsigned long length of the text
+ * @param long pointer receiving the value
+ *
+ * @return unsigned long number of characters consumed or 0 if there is no number
+ */
+unsigned long al_parseLong(const char *text, unsigned long length, long *value)
+{
+	assert(text);
+	assert(value);
+
+	unsigned long i = 0;
+	while(i < length && (text[i] == ' ' || text[i] == '\t'))
+		i++;
+
+	int negative = 0;
+	if(i < length && (text[i] == '-' || text[i] == '+'))
+		negative = text[i++] == '-';
+
+	unsigned long start = i, result = 0;
+	while(i < length && (unsigned char) (text[i] - '0') < 10)
+		result = result * 10 + (text[i++] - '0');
+
+	if(i == start)
+		return 0;
+
+	*value = negative ? -(long) result : (long) result;
+	return i;
+}
+
+/*
+ * Append the records of a text file, one per line, to the array list.
+ *
+ * Regular files are mapped and the lines counted up front, so the array is
+ * grown once. Other files are read in large blocks, growing the array once
+ * per block. parseFn creates an element from a line (without the line
+ * break) or returns NULL to skip it. Empty lines are skipped.
+ *
+ * @param AL pointer to the array list
+ * @param int file descriptor
+ * @param function pointer to the parse callback
+ *
+ * @return unsigned long number of appended elements
+ */
+unsigned long al_loadText(AL *list, int fd, void* (*parseFn)(const char*, unsigned long))
+{
+	assert(list);
+	assert(!list->map);
+	assert(parseFn);
+
+	unsigned long count = 0;
+	struct stat st;
+
+	settle(list);
+
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+		char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(offset >= 0 && text != MAP_FAILED)
+		{
+			unsigned long length = st.st_size - offset;
+			madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+			if(reserve(list, list->size + countLines(text + offset, length) + 1) == 0)
+				count = parseLines(list, text + offset, length, parseFn);
+			else
+				puts("ERROR: Out of memory");
+
+			munmap(text, st.st_size);
+			lseek(fd, st.st_size, SEEK_SET);
+			return count;
+		}
+		if(text != MAP_FAILED)
+			munmap(text, st.st_size);
+	}
+
+	unsigned long buffer_size = TEXT_BLOCK_SIZE, used = 0;
+	char *buffer = malloc(buffer_size);
+	ssize_t n = 0;
+
+	while(buffer && (n = read(fd, buffer + used, buffer_size - used)) > 0)
+	{
+		used += n;
+
+		/* only complete lines, the rest is moved to the front */
+		char *last = memrchr(buffer, '\n', used);
+		if(!last)
+		{
+			if(used == buffer_size)
+			{
+				char *new = realloc(buffer, buffer_size * 2);
+				if(!new)
+					break;
+				buffer = new;
+				buffer_size *= 2;
+			}
+			continue;
+		}
+
+		unsigned long length = last - buffer + 1;
+		if(reserve(list, list->size + countLines(buffer, length)) < 0)
+			break;
+		count += parseLines(list, buffer, length, parseFn);
+
+		memmove(buffer, buffer + length, used - length);
+		used -= length;
+	}
+
+	if(buffer && used > 0 && reserve(list, list->size + 1) == 0)
+		count += parseLines(list, buffer, used, parseFn);
+	if(!buffer || n > 0)
+		puts("ERROR: Out of memory");
+
+	free(buffer);
+	return count;
+}
+
+/*
+ * Write the formatted elements of the array list to a file.
+ *
+ * formatFn writes an element to a buffer of the given size and returns the
+ * length of the text. If the text doesn't fit, it returns the required
+ * length and is called again with a big enough buffer. Nothing is added
+ * between the elements.
+ *
+ * The elements are formatted in chunks into large buffers which are written
+ * with a single writev. Lists of at least THREAD_MIN_SIZE elements are
+ * formatted by MAX_THREADS threads, the output keeps the order of the list.
+ *
+ * @param AL pointer to the array list
+ * @param int file descriptor
+ * @param function pointer to the format callback
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int al_write(AL *list, int fd, unsigned long (*formatFn)(void*, char*, unsigned long))
+{
+	assert(list);
+	assert(formatFn);
+
+	WriteChunk chunks[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	int started[MAX_THREADS];
+	struct iovec iov[MAX_THREADS];
+	int count = list->size >= THREAD_MIN_SIZE ? MAX_THREADS : 1;
+	int ret = 0;
+	int t;
+
+	for(t = 0; t < count; t++)
+	{
+		chunks[t].list = list;
+		chunks[t].formatFn = formatFn;
+		chunks[t].buffer = malloc(WRITE_BUFFER_SIZE);
+		chunks[t].size = WRITE_BUFFER_SIZE;
+		chunks[t].failed = !chunks[t].buffer;
+		ret |= -chunks[t].failed;
+	}
+
+	unsigned long start;
+	for(start = 0; ret == 0 && start < list->size; start += count * WRITE_CHUNK_SIZE)
+	{
+		for(t = 0; t < count; t++)
+		{
+			chunks[t].start = start + t * WRITE_CHUNK_SIZE;
+			chunks[t].end = chunks[t].start + WRITE_CHUNK_SIZE;
+			if(chunks[t].start > list->size)
+				chunks[t].start = list->size;
+			if(chunks[t].end > list->size)
+				chunks[t].end = list->size;
+			started[t] = t > 0 && pthread_create(&threads[t], NULL, formatChunk, &chunks[t]) == 0;
+			if(t > 0 && !started[t])
+				formatChunk(&chunks[t]);
+		}
+		formatChunk(&chunks[0]);
+
+		for(t = 0; t < count; t++)
+		{
+			if(started[t])
+				pthread_join(threads[t], NULL);
+			if(chunks[t].failed)
+				ret = -1;
+			iov[t].iov_base = chunks[t].buffer;
+			iov[t].iov_len = chunks[t].used;
+		}
+
+		if(ret == 0)
+			ret = writevAll(fd, iov, count);
+	}
+
+	for(t = 0; t < count; t++)
+	{
+		free(chunks[t].buffer);
+	}
+	return ret;
+}
+
+/*
+ * Access the statistics of the array list. Only available if al.h is
+ * compiled with AL_STATS.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return ALStats pointer to the statistics or NULL if they are not compiled in
+ */
+const ALStats* al_stats(AL *list)
+{
+	assert(list);
+
+#ifdef AL_STATS
+	return &list->stats;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * Maintain a hash index of the elements, making al_indexOf, al_contains
+ * and al_removeValue O(1) on average. Without hashFn the index is keyed by
+ * the element pointers, otherwise by hashFn and compareFn. A list with a
+ * compareFn needs a hashFn, so that lookups find the same elements with
+ * and without index. Single adds, deletes and sets update the index in
+ * place, bulk changes make the next lookup rebuild it.
+ *
+ * @param AL pointer to the array list
+ * @param function pointer to the hash callback or NULL
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int al_indexCreate(AL *list, unsigned long (*hashFn)(void*))
+{
+	assert(list);
+	assert(!hashFn || list->compareFn);
+
+	if(!hashFn && list->compareFn)
+	{
+		puts("ERROR: An index of a list with compareFn needs a hashFn");
+		return -1;
+	}
+
+	al_indexDestroy(list);
+
+	ALIndex *index = malloc(sizeof(ALIndex));
+	if(!index)
+		return -1;
+
+	index->entries = NULL;
+	index->capacity = 0;
+	index->count = 0;
+	index->shifts_count = 0;
+	index->dirty = 1;
+	index->hashFn = hashFn;
+	list->index = index;
+
+	if(indexRebuild(list) < 0)
+	{
+		al_indexDestroy(list);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Drop the hash index of the array list.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return void
+ */
+void al_indexDestroy(AL *list)
+{
+	assert(list);
+
+	if(list->index)
+	{
+		free(list->index->entries);
+		free(list->index);
+		list->index = NULL;
+	}
+}
+
+/*
+ * Search an element. Elements are compared with compareFn if it is set
+ * and by pointer otherwise, with or without index. A pointer index is only
+ * used while the list has no compareFn.
+ *
+ * @param AL pointer to the array list
+ * @param void pointer to the data
+ *
+ * @return long index of the first equal element or -1 if there is none
+ */
+long al_indexOf(AL *list, void *data)
+{
+	assert(list);
+
+	if(list->index && data && (list->index->hashFn || !list->compareFn))
+	{
+		long found = indexFind(list, data);
+		if(found >= -1)
+			return found;
+		/* the index couldn't be rebuilt, fall back to searching */
+	}
+
+	ALIter iter;
+	al_iterInit(list, &iter);
+	void *element;
+	long i;
+	for(i = 0; al_next(&iter, &element); i++)
+	{
+		/* empty slots only match NULL */
+		if(element == data || (element && data && list->compareFn && list->compareFn(element, data) == 0))
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * @param AL pointer to the array list
+ * @param void pointer to the data
+ *
+ * @return int 1 if the array list contains the data, 0 otherwise
+ */
+int al_contains(AL *list, void *data)
+{
+	return al_indexOf(list, data) >= 0;
+}
+
+/*
+ * Remove the first element equal to data.
+ *
+ * @param AL pointer to the array list
+ * @param void pointer to the data
+ *
+ * @return void pointer to the removed data (not freed) or NULL if it doesn't exist
+ */
+void* al_removeValue(AL *list, void *data)
+{
+	long index = al_indexOf(list, data);
+
+	if(index < 0)
+		return NULL;
+	return al_del(list, index);
+}
+/*
+ * Delete lazily: al_del and al_pop only mark the element with a tombstone
+ * instead of moving the following elements. al_get, al_set and the readers
+ * translate the indexes with the tombstone bitmap, inserts and other
+ * operations which move elements compact the array first. The array is
+ * compacted as soon as more than threshold of its slots are tombstones or
+ * on al_compact. A threshold of 0 compacts and turns lazy deletion off.
+ *
+ * @param AL pointer to the array list
+ * @param double fraction of tombstones which triggers compaction (0 to 1)
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int al_lazyDelete(AL *list, double threshold)
+{
+	assert(list);
+	assert(!list->map);
+	assert(threshold >= 0 && threshold <= 1);
+
+	if(threshold == 0)
+	{
+		if(list->tombstones)
+		{
+			settle(list);
+			free(list->tombstones->bits);
+			free(list->tombstones->tree);
+			free(list->tombstones);
+			list->tombstones = NULL;
+		}
+		return 0;
+	}
+
+	if(!list->tombstones)
+	{
+		settle(list);
+		ALTombstones *tombstones = malloc(sizeof(ALTombstones));
+		if(!tombstones)
+			return -1;
+		tombstones->bits = NULL;
+		tombstones->tree = NULL;
+		tombstones->words = 0;
+		tombstones->dead = 0;
+		list->tombstones = tombstones;
+	}
+	list->tombstones->threshold = threshold;
+
+	if(list->tombstones->dead > threshold * (list->size + list->tombstones->dead))
+		compact(list);
+	return 0;
+}
+
+/*
+ * Remove the tombstones of a lazily deleting array list.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return void
+ */
+void al_compact(AL *list)
+{
+	assert(list);
+
+	settle(list);
+}
+
+/*
+ * Arrange the array list as a heap with the smallest element (by
+ * compareFn) first in O(n).
+ *
+ * @param AL pointer to the array list
+ *
+ * @return void
+ */
+void al_heapify(AL *list)
+{
+	assert(list);
+	assert(!list->map);
+	assert(list->compareFn);
+
+	settle(list);
+	indexInvalidate(list);
+
+	unsigned long i = list->size > 1 ? (list->size - 2) / HEAP_ARITY + 1 : 0;
+	while(i > 0)
+	{
+		i--;
+		siftDown(list, i, list->size, 1);
+	}
+}
+
+/*
+ * Insert an element into a heap in O(log n).
+ *
+ * @param AL pointer to the heap
+ * @param void pointer to the data
+ *
+ * @return void
+ */
+void al_heapPush(AL *list, void *data)
+{
+	assert(list);
+	assert(!list->map);
+	assert(list->compareFn);
+	assert(data);
+
+	settle(list);
+	increaseOne(list, list->size, data);
+	siftUp(list, list->size - 1);
+	if(list->array[list->size - 1] != data)
+		indexInvalidate(list);
+}
+
+/*
+ * Remove the smallest element of a heap in O(log n).
+ *
+ * @param AL pointer to the heap
+ *
+ * @return void pointer to the removed data (not freed) or NULL if the heap is empty
+ */
+void* al_heapPop(AL *list)
+{
+	assert(list);
+	assert(!list->map);
+	assert(list->compareFn);
+
+	if(list->size == 0)
+		return NULL;
+
+	settle(list);
+	void *top = list->array[0];
+	void *last = list->array[list->size - 1];
+	decreaseOne(list, list->size - 1);
+
+	if(list->size > 0)
+	{
+		indexInvalidate(list);
+		list->array[0] = last;
+		siftDown(list, 0, list->size, 1);
+	}
+	return top;
+}
+
+/*
+ * @param AL pointer to the heap
+ *
+ * @return void pointer to the smallest element or NULL if the heap is empty
+ */
+void* al_heapPeek(AL *list)
+{
+	assert(list);
+
+	return list->size > 0 ? at(list, 0) : NULL;
+}
+
+/*
+ * Remove the smallest element of a heap and insert an element with a
+ * single sift, cheaper than al_heapPop followed by al_heapPush.
+ *
+ * @param AL pointer to the heap
+ * @param void pointer to the data
+ *
+ * @return void pointer to the removed data (not freed) or NULL if the heap was empty
+ */
+void* al_heapReplace(AL *list, void *data)
+{
+	assert(list);
+	assert(!list->map);
+	assert(list->compareFn);
+	assert(data);
+
+	if(list->size == 0)
+	{
+		al_heapPush(list, data);
+		return NULL;
+	}
+
+	settle(list);
+	indexInvalidate(list);
+	void *top = list->array[0];
+	list->array[0] = data;
+	siftDown(list, 0, list->size, 1);
+	return top;
+}
+
+/*
+ * Sort the array list in ascending order (by compareFn) in place in
+ * O(n log n), using no extra memory.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return void
+ */
+void al_heapSort(AL *list)
+{
+	assert(list);
+	assert(!list->map);
+	assert(list->compareFn);
+
+	settle(list);
+	indexInvalidate(list);
+
+	/* a heap with the largest element first, which is moved to the end */
+	unsigned long i = list->size > 1 ? (list->size - 2) / HEAP_ARITY + 1 : 0;
+	while(i > 0)
+	{
+		i--;
+		siftDown(list, i, list->size, -1);
+	}
+	for(i = list->size; i > 1; i--)
+	{
+		void *top = list->array[0];
+		list->array[0] = list->array[i - 1];
+		list->array[i - 1] = top;
+		siftDown(list, 0, i - 1, -1);
+	}
+}
+
+/*
+ * Remove consecutive elements equal (by compareFn) to their predecessor,
+ * which leaves a sorted array list without duplicates.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return unsigned long number of removed (and freed) elements
+ */
+unsigned long al_unique(AL *list)
+{
+	assert(list);
+	assert(!list->map);
+	assert(list->compareFn);
+
+	if(list->size < 2)
+		return 0;
+
+	settle(list);
+
+	unsigned long last = 0, i;
+	for(i = 1; i < list->size; i++)
+	{
+		if(list->compareFn(list->array[last], list->array[i]) == 0)
+			list->freeFn(list->array[i]);
+		else
+			list->array[++last] = list->array[i];
+	}
+
+	unsigned long removed = list->size - last - 1;
+	if(removed)
+	{
+		STAT(list, frees, removed);
+		STAT(list, moved, last);
+		indexInvalidate(list);
+		list->size = last + 1;
+		shrink(list);
+	}
+	return removed;
+}
+
+/*
+ * The set operations take two array lists sorted by the compareFn of a and
+ * append the result to out. If out is NULL, a new array list is returned
+ * which shares the elements with a and b and doesn't free them. The output
+ * is grown once. Runs are skipped with galloping search, so combining a
+ * small and a big list costs O(small * log big).
+ * Duplicates are matched one to one.
+ */
+
+/*
+ * Merge two sorted array lists, keeping all elements. Equal elements of a
+ * come first.
+ *
+ * @param AL pointer to the first sorted array list
+ * @param AL pointer to the second sorted array list
+ * @param AL pointer to the output array list or NULL
+ *
+ * @return AL pointer to the output array list or NULL on failure
+ */
+AL* al_merge(AL *a, AL *b, AL *out)
+{
+	out = setOutput(a, b, out, a->size + b->size);
+	if(!out)
+		return NULL;
+
+	unsigned long i = 0, j = 0;
+	while(i < a->size && j < b->size)
+	{
+		unsigned long end = gallop(a->compareFn, a, i, at(b, j), 1);
+		appendRange(out, a, i, end);
+		i = end;
+		if(i == a->size)
+			break;
+
+		end = gallop(a->compareFn, b, j, at(a, i), 0);
+		appendRange(out, b, j, end);
+		j = end;
+	}
+	appendRange(out, a, i, a->size);
+	appendRange(out, b, j, b->size);
+	return out;
+}
+
+/*
+ * Elements of a and the elements of b which are not in a.
+ *
+ * @param AL pointer to the first sorted array list
+ * @param AL pointer to the second sorted array list
+ * @param AL pointer to the output array list or NULL
+ *
+ * @return AL pointer to the output array list or NULL on failure
+ */
+AL* al_union(AL *a, AL *b, AL *out)
+{
+	out = setOutput(a, b, out, a->size + b->size);
+	if(!out)
+		return NULL;
+
+	unsigned long i = 0, j = 0;
+	while(i < a->size && j < b->size)
+	{
+		unsigned long end = gallop(a->compareFn, a, i, at(b, j), 0);
+		appendRange(out, a, i, end);
+		i = end;
+		if(i == a->size)
+			break;
+
+		end = gallop(a->compareFn, b, j, at(a, i), 0);
+		appendRange(out, b, j, end);
+		j = end;
+		if(j < b->size && a->compareFn(at(a, i), at(b, j)) == 0)
+		{
+			appendRange(out, a, i, i + 1);
+			i++;
+			j++;
+		}
+	}
+	appendRange(out, a, i, a->size);
+	appendRange(out, b, j, b->size);
+	return out;
+}
+
+/*
+ * Elements of a which are also in b.
+ *
+ * @param AL pointer to the first sorted array list
+ * @param AL pointer to the second sorted array list
+ * @param AL pointer to the output array list or NULL
+ *
+ * @return AL pointer to the output array list or NULL on failure
+ */
+AL* al_intersect(AL *a, AL *b, AL *out)
+{
+	out = setOutput(a, b, out, a->size < b->size ? a->size : b->size);
+	if(!out)
+		return NULL;
+
+	unsigned long i = 0, j = 0;
+	while(i < a->size && j < b->size)
+	{
+		i = gallop(a->compareFn, a, i, at(b, j), 0);
+		if(i == a->size)
+			break;
+		j = gallop(a->compareFn, b, j, at(a, i), 0);
+		if(j < b->size && a->compareFn(at(a, i), at(b, j)) == 0)
+		{
+			appendRange(out, a, i, i + 1);
+			i++;
+			j++;
+		}
+	}
+	return out;
+}
+
+/*
+ * Elements of a which are not in b.
+ *
+ * @param AL pointer to the first sorted array list
+ * @param AL pointer to the second sorted array list
+ * @param AL pointer to the output array list or NULL
+ *
+ * @return AL pointer to the output array list or NULL on failure
+ */
+AL* al_difference(AL *a, AL *b, AL *out)
+{
+	out = setOutput(a, b, out, a->size);
+	if(!out)
+		return NULL;
+
+	unsigned long i = 0, j = 0;
+	while(i < a->size && j < b->size)
+	{
+		unsigned long end = gallop(a->compareFn, a, i, at(b, j), 0);
+		appendRange(out, a, i, end);
+		i = end;
+		if(i == a->size)
+			break;
+
+		j = gallop(a->compareFn, b, j, at(a, i), 0);
+		if(j < b->size && a->compareFn(at(a, i), at(b, j)) == 0)
+		{
+			i++;
+			j++;
 		}
-		list->array[index] = data;
 	}
-	list->size++;
+	appendRange(out, a, i, a->size);
+	return out;
 }
 
-void decreaseOne(AL *list, unsigned long index)
+/*
+ * Apply a batch of operations as if they were called one after another,
+ * but move every element at most once.
+ *
+ * The operations are first applied to a treap of runs of the old array and
+ * new elements, which costs O(log n) per operation and no element moves.
+ * The new array is then allocated once and filled in one pass. As with the
+ * single calls, an add behind the end appends, deletes and sets of an index
+ * which doesn't exist are ignored, and the elements which are deleted or
+ * replaced are handed to the caller (not freed): removed[i] is the element
+ * removed by ops[i], or NULL. Without removed, they are freed with freeFn.
+ *
+ * @param AL pointer to the array list
+ * @param ALBatchOp pointer to the operations
+ * @param unsigned long number of operations
+ * @param void pointer to n pointers receiving the removed elements or NULL
+ *
+ * @return int 0 on success or -1 on failure (the list is unchanged)
+ */
+int al_applyBatch(AL *list, const ALBatchOp *ops, unsigned long n, void **removed)
 {
-	if(DEL_THRESHOLD * list->size <= list->memory_size && list->size >= MIN_SIZE)
+	assert(list);
+	assert(!list->map);
+	assert(ops || n == 0);
+
+	if(n == 0)
+		return 0;
+
+	settle(list);
+
+	BatchPool pool;
+	pool.nodes = malloc(sizeof(BatchNode) * (2 * n + 1));
+	pool.used = 0;
+	pool.seed = 88172645463325252ULL;
+	void **freed = removed ? removed : malloc(sizeof(void *) * n);
+	if(!pool.nodes || !freed)
 	{
-		list->memory_size /= DEL_SIZE_DIVIDE_FACTOR;
-		void **new = malloc(sizeof(void *) * list->memory_size);
+		free(pool.nodes);
+		if(!removed)
+			free(freed);
+		return -1;
+	}
 
-		unsigned long i;
-		for(i = 0; i < index; i++)
-		{
-			new[i] = list->array[i];
-		}
-		list->freeFn(list->array[index]);
-		// list->size--;
-		for(i = index+1; i <= list->size; i++)
+	BatchNode *root = list->size ? batchNode(&pool, 0, list->size, NULL) : NULL;
+	BatchNode *left, *middle, *right;
+	unsigned long nfreed = 0, i;
+
+	for(i = 0; i < n; i++)
+	{
+		unsigned long size = root ? root->size : 0;
+		unsigned long index = ops[i].index;
+		freed[i] = NULL;
+
+		switch(ops[i].type)
 		{
-			new[i-1] = list->array[i];
+		case AL_BATCH_PUSH:
+			assert(ops[i].data);
+			root = batchMerge(root, batchNode(&pool, 0, 0, ops[i].data));
+			break;
+		case AL_BATCH_ADD:
+			assert(ops[i].data);
+			batchSplit(&pool, root, index < size ? index : size, &left, &right);
+			root = batchMerge(batchMerge(left, batchNode(&pool, 0, 0, ops[i].data)), right);
+			break;
+		case AL_BATCH_DEL:
+		case AL_BATCH_SET:
+			if(index >= size)
+				break;
+			batchSplit(&pool, root, index, &left, &right);
+			batchSplit(&pool, right, 1, &middle, &right);
+			freed[i] = middle->length ? list->array[middle->start] : middle->data;
+			nfreed++;
+			if(ops[i].type == AL_BATCH_SET)
+			{
+				middle->length = 0;
+				middle->data = ops[i].data;
+				left = batchMerge(left, middle);
+			}
+			root = batchMerge(left, right);
+			break;
+		default:
+			assert(0);
 		}
+	}
 
-		free(list->array);
-		list->array = new;
-	} else {
-		list->freeFn(list->array[index]);
-		unsigned long i;
-		for(i = index; i < list->size; i++)
+	unsigned long size = root ? root->size : 0;
+	unsigned long memory_size = list->memory_size;
+	if(ADD_THRESHOLD * size >= memory_size || (DEL_THRESHOLD * size <= memory_size && memory_size > MIN_SIZE))
+		memory_size = size * ADD_SIZE_MULTIPLY_FACTOR;
+	if(memory_size < MIN_SIZE)
+		memory_size = MIN_SIZE;
+
+	void **new = malloc(sizeof(void *) * memory_size);
+	if(!new)
+	{
+		free(pool.nodes);
+		if(!removed)
+			free(freed);
+		return -1;
+	}
+
+	unsigned long filled = 0;
+	batchCollect(root, list->array, new, &filled);
+	assert(filled == size);
+
+	STAT(list, grows, memory_size > list->memory_size);
+	STAT(list, shrinks, memory_size < list->memory_size);
+	STAT(list, moved, size);
+	STAT(list, bytes_allocated, sizeof(void *) * memory_size);
+	free(list->array);
+	list->array = new;
+	list->size = size;
+	list->memory_size = memory_size;
+	STAT_PEAK(list);
+	indexInvalidate(list);
+	pressure(list);
+
+	if(!removed)
+	{
+		for(i = 0; i < n; i++)
 		{
-			list->array[i] = list->array[i+1];
+			if(freed[i])
+				list->freeFn(freed[i]);
 		}
-		//list->array[i] = NULL;
+		STAT(list, frees, nfreed);
+		free(freed);
 	}
-	list->size--;
+
+	free(pool.nodes);
+	return 0;
 }
 
 /*
- * Create an array list.
+ * Find the next slot which isn't NULL. Sparse lists skip the empty slots
+ * without visiting them.
  *
- * @param unsigned int initial size of the array list
+ * @param AL pointer to the array list
+ * @param unsigned long index to start at
  *
- * @return AL pointer to the created array list
+ * @return long index of the next element which isn't NULL or -1 if there is none
  */
-AL* al_create(unsigned int size)
+long al_nextOccupied(AL *list, unsigned long index)
 {
-	assert(size > 0);
-	
-	AL *new = malloc(sizeof(AL));
-	void **array = malloc(sizeof(void *) * size);
+	assert(list);
 
-	if(new && array)
+	if(!list->sparse)
 	{
-		new->array = array;
-		new->size = 0;
-		new->memory_size = size;
+		for(; index < list->size; index++)
+		{
+			if(at(list, index))
+				return index;
+		}
+		return -1;
 	}
-	else
+
+	ALSparse *sparse = list->sparse;
+	unsigned long b = index / SPARSE_BLOCK_SIZE;
+	if(index >= list->size)
+		return -1;
+
+	/* the rest of the first block */
+	if(sparse->blocks[b])
 	{
-		puts("ERROR: Out of memory");
+		uint64_t bits = sparse->blocks[b]->bits & (~0ULL << (index % SPARSE_BLOCK_SIZE));
+		if(bits)
+			return b * SPARSE_BLOCK_SIZE + __builtin_ctzll(bits);
 	}
 
-	return new;
+	/* the next allocated block, blocks are never empty */
+	b++;
+	unsigned long word = b / 64, words = (sparse->blocks_size + 63) / 64;
+	uint64_t summary = word < words ? sparse->summary[word] & (~0ULL << (b % 64)) : 0;
+	while(!summary)
+	{
+		if(++word >= words)
+			return -1;
+		summary = sparse->summary[word];
+	}
+	b = word * 64 + __builtin_ctzll(summary);
+	index = b * SPARSE_BLOCK_SIZE + __builtin_ctzll(sparse->blocks[b]->bits);
+	return index < list->size ? (long) index : -1;
 }
 
 /*
- * Access an element of the array list.
+ * Iterate over the array list without the bounds check and the index
+ * translation of al_get per element. The iterator prefetches the element
+ * distance positions ahead (PREFETCH_DISTANCE by default, 0 turns it
+ * off), so the loads of the payloads overlap. The array list must not be
+ * changed while it is iterated.
+ *
+ * The iterator is set up in place, it holds a buffer of SPAN_SIZE
+ * elements for al_nextSpan.
  *
  * @param AL pointer to the array list
- * @param unsigned long index
+ * @param ALIter pointer to the iterator, positioned before the first element
  *
- * @return void pointer to the element or NULL if it doesn't exist
+ * @return void
  */
-void* al_get(AL *list, unsigned long index)
+void al_iterInit(AL *list, ALIter *iter)
 {
 	assert(list);
+	assert(iter);
 
-	if(index >= list->size)
-		return NULL;
-	else
-		return list->array[index];
+	iter->list = list;
+	iter->index = 0;
+	iter->slot = 0;
+	iter->distance = PREFETCH_DISTANCE;
 }
 
 /*
- * Access an element of the array list.
+ * Advance the iterator.
  *
- * @param AL pointer to the array list
- * @param unsigned long index
+ * @param ALIter pointer to the iterator
+ * @param void pointer pointer receiving the element
  *
- * @return void pointer to the element or NULL if it doesn't exist
+ * @return int 1 if there was a next element, 0 at the end
  */
-void** al_range(AL *list, unsigned long start, unsigned long end)
+int al_next(ALIter *iter, void **data)
 {
-	assert(list);
-	assert(start < end);
+	assert(iter);
+	assert(data);
 
-	unsigned long size = end - start;
-	void **range = malloc(sizeof(void *) * size);
+	AL *list = iter->list;
+	if(iter->index >= list->size)
+		return 0;
 
-	unsigned long i;
-	for(i = 0; start < end; i++)
+	if(list->map || list->sparse)
 	{
-		range[i] = list->array[i+start++];
+		*data = at(list, iter->index++);
+		return 1;
 	}
 
-	return range;
+	/* step over tombstones, the physical slot advances with the index */
+	ALTombstones *tombstones = list->tombstones;
+	if(tombstones && tombstones->dead)
+	{
+		while(iter->slot / 64 < tombstones->words && tombstones->bits[iter->slot / 64] >> (iter->slot % 64) & 1)
+			iter->slot++;
+	}
+
+	unsigned long end = list->size + (tombstones ? tombstones->dead : 0);
+	if(iter->distance && iter->slot + iter->distance < end)
+		__builtin_prefetch(list->array[iter->slot + iter->distance]);
+
+	*data = list->array[iter->slot++];
+	iter->index++;
+	return 1;
 }
 
 /*
- * Change an element in the array list.
+ * Hand out the following elements as a contiguous array. A plain array
+ * list gives out the rest of its array at once and a lazily deleting one
+ * the runs between the tombstones. Other array lists are copied in spans
+ * of at most SPAN_SIZE elements into the iterator. The span stays valid
+ * until the next call.
  *
- * @param AL pointer to the array list
- * @param unsigned long index
- * @param void pointer with the new data
+ * @param ALIter pointer to the iterator
+ * @param void pointer pointer pointer receiving the span
  *
- * @return void pointer to the removed data if successfully changed or NULL if it doesn't exist
+ * @return unsigned long number of elements in the span, 0 at the end
  */
-void* al_set(AL *list, unsigned long index, void *data)
+unsigned long al_nextSpan(ALIter *iter, void ***span)
 {
-	assert(list);
+	assert(iter);
+	assert(span);
 
-	if(index >= list->size)
-		return NULL;
-	void* old = list->array[index];
-	list->array[index] = data;
-	return old;
+	AL *list = iter->list;
+	if(iter->index >= list->size)
+		return 0;
+
+	unsigned long count;
+	if(list->map || list->sparse)
+	{
+		count = list->size - iter->index < SPAN_SIZE ? list->size - iter->index : SPAN_SIZE;
+		unsigned long i;
+		for(i = 0; i < count; i++)
+		{
+			iter->buffer[i] = at(list, iter->index + i);
+		}
+		*span = iter->buffer;
+		iter->index += count;
+		return count;
+	}
+
+	ALTombstones *tombstones = list->tombstones;
+	if(!tombstones || !tombstones->dead)
+	{
+		count = list->size - iter->index;
+		*span = list->array + iter->index;
+		iter->index += count;
+		iter->slot = iter->index;
+		return count;
+	}
+
+	unsigned long slot = iter->slot, end = list->size + tombstones->dead;
+	while(slot / 64 < tombstones->words && tombstones->bits[slot / 64] >> (slot % 64) & 1)
+		slot++;
+
+	/* the run of live slots ends at the next set bit */
+	unsigned long stop = end;
+	unsigned long word = slot / 64;
+	if(word < tombstones->words)
+	{
+		uint64_t bits = tombstones->bits[word] & (~0ULL << (slot % 64));
+		while(!bits && ++word < tombstones->words)
+			bits = tombstones->bits[word];
+		if(bits && word * 64 + __builtin_ctzll(bits) < end)
+			stop = word * 64 + __builtin_ctzll(bits);
+	}
+
+	count = stop - slot;
+	*span = list->array + slot;
+	iter->slot = stop;
+	iter->index += count;
+	return count;
 }
 
 /*
- * Push an element to the array list.
+ * Call visitFn for the elements in order until it returns non-zero. The
+ * elements are visited span by span with the payloads prefetched
+ * PREFETCH_DISTANCE elements ahead.
  *
  * @param AL pointer to the array list
- * @param void pointer to the data
+ * @param function pointer to the visit callback, called with the element and the context
+ * @param void pointer to the context
  *
- * @return unsigned long index of the inserted element
+ * @return unsigned long number of visited elements
  */
-unsigned long al_push(AL *list, void *data)
+unsigned long al_visit(AL *list, int (*visitFn)(void*, void*), void *context)
 {
 	assert(list);
-	assert(data);
-	assert(list->array);
+	assert(visitFn);
 
-	increaseOne(list, list->size, data);
+	ALIter iter;
+	al_iterInit(list, &iter);
+	unsigned long visited = 0, count;
+	void **span;
 
-	return list->size;
+	while((count = al_nextSpan(&iter, &span)))
+	{
+		unsigned long i;
+		for(i = 0; i < count; i++)
+		{
+			if(i + PREFETCH_DISTANCE < count)
+				__builtin_prefetch(span[i + PREFETCH_DISTANCE]);
+			visited++;
+			if(visitFn(span[i], context))
+				return visited;
+		}
+	}
+	return visited;
 }
 
 /*
- * Pop an element from the array list.
+ * Append the elements of src at the given indexes to dst, growing dst
+ * once. dst shares the elements with src. At least THREAD_MIN_SIZE
+ * indexes are split across MAX_THREADS threads.
  *
- * @param AL pointer to the array list
- * @param void pointer to the data
+ * @param AL pointer to the destination array list
+ * @param AL pointer to the source array list
+ * @param const unsigned long pointer to the indexes in src
+ * @param unsigned long number of indexes
  *
- * @return void pointer to the removed data or NULL if it doesn't exist
+ * @return int 0 on success or -1 on failure
  */
-void* al_pop(AL *list)
+int al_gather(AL *dst, AL *src, const unsigned long *indexes, unsigned long count)
 {
-	assert(list);
+	assert(dst && src);
+	assert(!dst->map);
+	assert(indexes || count == 0);
 
-	if(list->size > 0)
+	settle(dst);
+	if(reserve(dst, dst->size + count) < 0)
 	{
-		unsigned long last = list->size-1;
-		void* old = list->array[last];
-
-		decreaseOne(list, last);
-		return old;
+		puts("ERROR: Out of memory");
+		return -1;
 	}
-	else
+
+#ifndef NDEBUG
+	unsigned long i;
+	for(i = 0; i < count; i++)
 	{
-		return NULL;
+		assert(indexes[i] < src->size);
 	}
+#endif
+
+	int plain = !src->map && !src->sparse && !(src->tombstones && src->tombstones->dead);
+	runChunks(gatherChunk, src, dst->array + dst->size, plain ? src->array : NULL, indexes, count);
+
+	STAT(dst, moved, count);
+	dst->size += count;
+	indexInvalidate(dst);
+	return 0;
 }
 
 /*
- * Add an element to the array list.
+ * Store the first count elements of src at the given indexes of dst. The
+ * indexes have to be distinct. The replaced elements are not freed (like
+ * al_set). At least THREAD_MIN_SIZE indexes are split across MAX_THREADS
+ * threads.
  *
- * @param AL pointer to the array list
- * @param unsingend long index
- * @param void pointer to the data
+ * @param AL pointer to the destination array list
+ * @param AL pointer to the source array list
+ * @param const unsigned long pointer to the indexes in dst
+ * @param unsigned long number of indexes
  *
- * @return unsigned long index of the inserted element
+ * @return void
  */
-unsigned long al_add(AL *list, unsigned long index, void *data)
+void al_scatter(AL *dst, AL *src, const unsigned long *indexes, unsigned long count)
 {
-	assert(list);
-	assert(data);
-	assert(list->array);
+	assert(dst && src);
+	assert(dst != src);
+	assert(!dst->map);
+	assert(indexes || count == 0);
+	assert(count <= src->size);
 
-	increaseOne(list, index, data);
+	settle(dst);
 
-	return list->size;
+#ifndef NDEBUG
+	unsigned long i;
+	for(i = 0; i < count; i++)
+	{
+		assert(indexes[i] < dst->size);
+	}
+#endif
+
+	int plain = !src->map && !src->sparse && !(src->tombstones && src->tombstones->dead);
+	runChunks(scatterChunk, src, dst->array, plain ? src->array : NULL, indexes, count);
+
+	STAT(dst, moved, count);
+	indexInvalidate(dst);
 }
 
 /*
- * Remove an element of the array list at a specific index.
+ * Reorder the array list in place so that the element at i is the one
+ * which was at permutation[i]. Every cycle of the permutation is followed
+ * once and a bitmap marks the visited positions, so the only extra memory
+ * is a bit per element.
  *
  * @param AL pointer to the array list
- * @param unsingend long index
+ * @param const unsigned long pointer to a permutation of 0 to size - 1
  *
- * @return void pointer to the removed data or NULL if it doesn't exist
+ * @return int 0 on success or -1 on failure
  */
-void* al_del(AL *list, unsigned long index)
+int al_permute(AL *list, const unsigned long *permutation)
 {
 	assert(list);
+	assert(!list->map);
+	assert(permutation || list->size == 0);
 
-	if(index >= list->size)
-		return NULL;
+	settle(list);
+
+	uint64_t *visited = calloc(list->size / 64 + 1, sizeof(uint64_t));
+	if(!visited)
+	{
+		puts("ERROR: Out of memory");
+		return -1;
+	}
 
-	void *old = list->array[index];
+	unsigned long start;
+	for(start = 0; start < list->size; start++)
+	{
+		if(visited[start / 64] >> (start % 64) & 1)
+			continue;
 
-	decreaseOne(list, index);
+		void *first = list->array[start];
+		unsigned long i = start;
+		for(;;)
+		{
+			unsigned long from = permutation[i];
+			assert(from < list->size);
+			visited[i / 64] |= 1ULL << (i % 64);
+			if(from == start)
+				break;
+			assert(!(visited[from / 64] >> (from % 64) & 1));
+			list->array[i] = list->array[from];
+			i = from;
+		}
+		list->array[i] = first;
+	}
 
-	return old;
+	free(visited);
+	STAT(list, moved, list->size);
+	indexInvalidate(list);
+	return 0;
 }
 
 /*
- * Add an array of void pointers to the array list.
+ * The registry keeps track of the live array lists of the process and
+ * the memory reserved by their arrays, see al_totals. With a budget, a
+ * registered list which grows or removes elements while the budget is
+ * exceeded gives back its own unused memory, see account. Lists never
+ * shrink each other on their own, only al_trim and al_setBudget do.
  *
- * @param AL pointer to the array list
- * @param void pointer to the array
+ * Start (1) or stop (0) registering the array lists created from now on.
+ *
+ * @param int 1 to enable, 0 to disable
  *
  * @return void
  */
-void al_addAll(AL *list, unsigned int data_size, void **data)
-{
-	assert(list);
-	assert(data);
-	assert(list->array);
-
-	increase(list, list->size, data_size, data);
-
-	// printf("Add %d\n", *(int *)data);
-	// al_print(list);
-	// printf("size %ld\n", list->size);
-	// printf("memory_size %ld\n", list->memory_size);
-}
-
-void al_delRange(AL *list, unsigned long start, unsigned long end)
+void al_track(int enable)
 {
-	decrease(list, start, end);
+	__atomic_store_n(&registry.track, enable, __ATOMIC_RELAXED);
 }
 
 /*
- * Reverse the array list.
+ * Add an array list to the registry. al_clear removes it.
  *
  * @param AL pointer to the array list
  *
- * @return void
+ * @return int 0 on success or -1 on failure
  */
-void al_reverse(AL *list)
+int al_register(AL *list)
 {
 	assert(list);
 
-	unsigned long i = 0, j = list->size;
-	void *tmp;
-
-	while(i < j)
+	int ret = 0;
+	pthread_mutex_lock(&registry_lock);
+	if(list->registered < 0)
 	{
-		j--;
-//		printf("i = %ld, j = %ld\n", i, j);
-//		printf("left: %p, right: %p\n", list->array[i], list->array[j]);
-		tmp = list->array[i];
-		list->array[i] = list->array[j];
-		list->array[j] = tmp;
-//		printf("left: %p, right: %p\n", list->array[i], list->array[j]);
-		i++;
+		if(registry.size == registry.memory_size)
+		{
+			unsigned long memory_size = registry.memory_size ? registry.memory_size * 2 : REGISTRY_MIN_SIZE;
+			AL **lists = realloc(registry.lists, sizeof(AL *) * memory_size);
+			if(lists)
+			{
+				registry.lists = lists;
+				registry.memory_size = memory_size;
+			}
+		}
+		if(registry.size < registry.memory_size)
+		{
+			__atomic_store_n(&list->registered, registry.size, __ATOMIC_RELAXED);
+			registry.lists[registry.size++] = list;
+			accountLocked(list);
+		}
+		else
+		{
+			ret = -1;
+		}
 	}
+	pthread_mutex_unlock(&registry_lock);
+	return ret;
 }
 
 /*
- * Deallocate memory of the array list.
+ * Remove an array list from the registry.
  *
  * @param AL pointer to the array list
  *
  * @return void
  */
-void al_clear(AL *list)
+void al_unregister(AL *list)
 {
 	assert(list);
 
-	while(list->size)
+	if(__atomic_load_n(&list->registered, __ATOMIC_RELAXED) < 0)
+		return;
+
+	pthread_mutex_lock(&registry_lock);
+	if(list->registered >= 0)
 	{
-		list->freeFn(list->array[list->size]);
-		list->array[list->size] = NULL;
-		list->size--;
+		AL *last = registry.lists[--registry.size];
+		registry.lists[list->registered] = last;
+		__atomic_store_n(&last->registered, list->registered, __ATOMIC_RELAXED);
+		__atomic_store_n(&list->registered, -1, __ATOMIC_RELAXED);
+		registry.reserved -= list->reserved;
+		list->reserved = 0;
+		__atomic_store_n(&registry.over, registry.budget && registry.reserved > registry.budget, __ATOMIC_RELAXED);
 	}
-	free(list->array);
-	list->array = NULL;
-	// list->size = 0;
-	list->memory_size = 0;
+	pthread_mutex_unlock(&registry_lock);
 }
 
 /*
- * Print the array list to the console.
+ * Limit the memory reserved by the arrays of the registered lists. The
+ * budget is enforced right away, later the lists which change give back
+ * their own unused memory while it is exceeded, see al_track.
  *
- * @param AL pointer to the array list
+ * @param unsigned long budget in bytes or 0 for no limit
  *
  * @return void
  */
-void al_print(AL *list)
+void al_setBudget(unsigned long bytes)
 {
-	assert(list);
-	assert(list->printFn);
+	pthread_mutex_lock(&registry_lock);
+	registry.budget = bytes;
+	if(bytes)
+		trimLocked(bytes);
+	__atomic_store_n(&registry.over, registry.budget && registry.reserved > registry.budget, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&registry_lock);
+}
+
+/*
+ * Shrink registered lists to fit, those with the most unused memory first,
+ * until their arrays reserve at most bytes.
+ *
+ * @param unsigned long target in bytes, 0 trims all lists
+ *
+ * @return unsigned long number of bytes given back
+ */
+unsigned long al_trim(unsigned long bytes)
+{
+	pthread_mutex_lock(&registry_lock);
+	unsigned long trimmed = trimLocked(bytes);
+	pthread_mutex_unlock(&registry_lock);
+	return trimmed;
+}
 
+/*
+ * Memory of the registered lists: the bytes reserved by their arrays, the
+ * bytes in use by elements, the budget and how often and how much was
+ * trimmed. The bytes in use are read from the lists, they are only exact
+ * while no list is changed by another thread.
+ *
+ * @return ALTotals totals of the registry
+ */
+ALTotals al_totals(void)
+{
+	ALTotals totals;
 	unsigned long i;
-	for(i = 0; i < list->size; i++)
+
+	pthread_mutex_lock(&registry_lock);
+	totals.lists = registry.size;
+	totals.reserved = registry.reserved;
+	totals.used = 0;
+	for(i = 0; i < registry.size; i++)
 	{
-		printf("index: %ld data: ", i);
-		list->printFn(list->array[i]);
+		AL *list = registry.lists[i];
+		if(list->array)
+			totals.used += sizeof(void *) * (list->size + (list->tombstones ? list->tombstones->dead : 0));
 	}
-	puts("---");
-}
\ No newline at end of file
+	totals.budget = registry.budget;
+	totals.trims = registry.trims;
+	totals.trimmed = registry.trimmed;
+	pthread_mutex_unlock(&registry_lock);
+	return totals;
+}
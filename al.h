@@ -1,8 +1,131 @@
+#ifndef AL_H
+#define AL_H
+
+#include <stdint.h>
+
+/* uncomment to count reallocations and copies per array list, see al_stats */
+// #define AL_STATS
+/* uncomment to also keep latency histograms per operation (implies AL_STATS) */
+// #define AL_STATS_LATENCY
+
+#if defined(AL_STATS_LATENCY) && !defined(AL_STATS)
+#define AL_STATS
+#endif
+
 #define MIN_SIZE 10
 #define ADD_THRESHOLD 1
 #define ADD_SIZE_MULTIPLY_FACTOR 2
 #define DEL_THRESHOLD 3
 #define DEL_SIZE_DIVIDE_FACTOR 2
+#define MAX_THREADS 4
+#define THREAD_MIN_SIZE 100000
+#define AL_STATS_BUCKETS 64
+#define INDEX_SHIFTS 32
+#define HEAP_ARITY 4
+#define PREFETCH_DISTANCE 8
+#define SPAN_SIZE 256
+
+enum
+{
+	AL_OP_GET,
+	AL_OP_SET,
+	AL_OP_PUSH,
+	AL_OP_POP,
+	AL_OP_ADD,
+	AL_OP_DEL,
+	AL_OP_DEL_RANGE,
+	AL_OP_ADD_ALL,
+	AL_OP_REVERSE,
+	AL_OP_CLEAR,
+	AL_OPS
+};
+
+enum
+{
+	AL_BATCH_PUSH,
+	AL_BATCH_ADD,
+	AL_BATCH_DEL,
+	AL_BATCH_SET
+};
+
+typedef struct ArrayListBatchOp
+{
+	int type;
+	unsigned long index;
+	void *data;
+} ALBatchOp;
+
+typedef struct ArrayListStats
+{
+	unsigned long grows;
+	unsigned long shrinks;
+	unsigned long moved;
+	unsigned long bytes_allocated;
+	unsigned long peak_memory_size;
+	unsigned long frees;
+#ifdef AL_STATS_LATENCY
+	unsigned long latency[AL_OPS][AL_STATS_BUCKETS];
+#endif
+} ALStats;
+
+typedef struct ArrayListMap
+{
+	void *addr;
+	unsigned long length;
+	unsigned long stride;
+	const uint64_t *offsets;
+	const char *data;
+} ALMap;
+
+typedef struct ArrayListIndexEntry
+{
+	void *data;
+	unsigned long hash;
+	unsigned long position;
+	unsigned long shifts;
+} ALIndexEntry;
+
+typedef struct ArrayListIndexShift
+{
+	unsigned long position;
+	long delta;
+} ALIndexShift;
+
+typedef struct ArrayListIndex
+{
+	ALIndexEntry *entries;
+	unsigned long capacity;
+	unsigned long count;
+	int dirty;
+	unsigned long (*hashFn)(void*);
+	ALIndexShift shifts[INDEX_SHIFTS];
+	unsigned long shifts_count;
+} ALIndex;
+
+typedef struct ArrayListTombstones
+{
+	uint64_t *bits;
+	unsigned long *tree;
+	unsigned long words;
+	unsigned long dead;
+	double threshold;
+} ALTombstones;
+
+typedef struct ArrayListSparseBlock
+{
+	uint64_t bits;
+	unsigned long capacity;
+	void *values[];
+} ALSparseBlock;
+
+typedef struct ArrayListSparse
+{
+	ALSparseBlock **blocks;
+	uint64_t *summary;
+	unsigned long blocks_size;
+	unsigned long count;
+	double threshold;
+} ALSparse;
 
 typedef struct ArrayList
 {
@@ -12,9 +135,38 @@ typedef struct ArrayList
 	int (*compareFn)(void*, void*);
 	void (*freeFn)(void*);
 	void (*printFn)(void*);
+	ALMap *map;
+	ALIndex *index;
+	ALTombstones *tombstones;
+	ALSparse *sparse;
+	long registered;
+	unsigned long reserved;
+#ifdef AL_STATS
+	ALStats stats;
+#endif
 } AL;
 
+typedef struct ArrayListTotals
+{
+	unsigned long lists;
+	unsigned long reserved;
+	unsigned long used;
+	unsigned long budget;
+	unsigned long trims;
+	unsigned long trimmed;
+} ALTotals;
+
+typedef struct ArrayListIterator
+{
+	AL *list;
+	unsigned long index;
+	unsigned long slot;
+	unsigned long distance;
+	void *buffer[SPAN_SIZE];
+} ALIter;
+
 AL* al_create(unsigned int size);
+AL* al_createSparse(unsigned long size, double threshold);
 void* al_get(AL *list, unsigned long index);
 void* al_set(AL *list, unsigned long index, void *data);
 unsigned long al_push(AL *list, void *data);
@@ -26,4 +178,54 @@ void al_delRange(AL *list, unsigned long start, unsigned long end);
 void al_addAll(AL *list, unsigned int data_size, void **data);
 void al_reverse(AL *list);
 void al_clear(AL *list);
-void al_print(AL *list);
\ No newline at end of file
+void al_print(AL *list);
+int al_save(AL *list, int fd, unsigned long (*serializeFn)(void*, void*, unsigned long));
+AL* al_load(int fd, void* (*deserializeFn)(const void*, unsigned long));
+AL* al_mapReadOnly(const char *path);
+unsigned long al_parseLong(const char *text, unsigned long length, long *value);
+unsigned long al_loadText(AL *list, int fd, void* (*parseFn)(const char*, unsigned long));
+int al_write(AL *list, int fd, unsigned long (*formatFn)(void*, char*, unsigned long));
+const ALStats* al_stats(AL *list);
+int al_indexCreate(AL *list, unsigned long (*hashFn)(void*));
+void al_indexDestroy(AL *list);
+long al_indexOf(AL *list, void *data);
+int al_contains(AL *list, void *data);
+void* al_removeValue(AL *list, void *data);
+int al_lazyDelete(AL *list, double threshold);
+void al_compact(AL *list);
+void al_heapify(AL *list);
+void al_heapPush(AL *list, void *data);
+void* al_heapPop(AL *list);
+void* al_heapPeek(AL *list);
+void* al_heapReplace(AL *list, void *data);
+void al_heapSort(AL *list);
+unsigned long al_unique(AL *list);
+AL* al_merge(AL *a, AL *b, AL *out);
+AL* al_union(AL *a, AL *b, AL *out);
+AL* al_intersect(AL *a, AL *b, AL *out);
+AL* al_difference(AL *a, AL *b, AL *out);
+int al_applyBatch(AL *list, const ALBatchOp *ops, unsigned long n, void **removed);
+long al_nextOccupied(AL *list, unsigned long index);
+void al_iterInit(AL *list, ALIter *iter);
+int al_next(ALIter *iter, void **data);
+unsigned long al_nextSpan(ALIter *iter, void ***span);
+unsigned long al_visit(AL *list, int (*visitFn)(void*, void*), void *context);
+int al_gather(AL *dst, AL *src, const unsigned long *indexes, unsigned long count);
+void al_scatter(AL *dst, AL *src, const unsigned long *indexes, unsigned long count);
+int al_permute(AL *list, const unsigned long *permutation);
+/*
+ * The memory budget of the registry is best-effort: lists shrink their own
+ * arrays when they grow or remove elements while the budget is exceeded,
+ * keep some room to grow and can't go below their elements. Idle lists
+ * keep their memory until al_trim. al_trim and al_setBudget are
+ * single-threaded: they shrink other lists, call them while no registered
+ * list is in use.
+ */
+void al_track(int enable);
+int al_register(AL *list);
+void al_unregister(AL *list);
+void al_setBudget(unsigned long bytes);
+unsigned long al_trim(unsigned long bytes);
+ALTotals al_totals(void);
+
+#endif
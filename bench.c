@@ -0,0 +1,440 @@
+/**
+ *  arrayList
+ *
+ *  https://github.com/tooreht/arrayList
+ *
+ *  @file   bench.c
+ *  @brief  Benchmarks of arrayList.
+ *
+ *  This programm measures the operations of the array list over a range of
+ *  list sizes and access patterns and writes the results as CSV to stdout:
+ *
+ *  op,pattern,size,ops,ns_per_op,p50_ns,p99_ns,p999_ns,peak_rss_kb
+ *
+ *  Every operation is timed on its own with a monotonic clock, the timer
+ *  overhead is subtracted. Work needed to keep the list at its size (undoing
+ *  inserts and deletes at the front or random indices, refilling a drained
+ *  list, rebuilding after clear) is not timed. peak_rss_kb is the
+ *  peak resident set size during the run, where the kernel allows to reset it.
+ *
+ *  usage: benchmark [-s 10,1000,...] [-o ops] [-r seed]
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "al.h"
+
+#define DEFAULT_SIZES "10,100,1000,10000,100000,1000000,10000000"
+#define DEFAULT_OPS 1000000
+#define MAX_SAMPLES (1 << 20)
+#define SHIFT_WORK 1000000000UL
+#define LIST_WORK 100000000UL
+#define RANGE_SIZE 16
+
+enum Pattern { APPEND, FRONT, RANDOM, OSCILLATE };
+
+const char *patterns[] = { "append", "front", "random", "oscillate" };
+
+typedef struct Benchmark
+{
+    const char *op;
+    enum Pattern pattern;
+} Benchmark;
+
+Benchmark benchmarks[] = {
+    { "push", APPEND },
+    { "pop", APPEND },
+    { "get", APPEND }, { "get", FRONT }, { "get", RANDOM },
+    { "set", APPEND }, { "set", FRONT }, { "set", RANDOM },
+    { "add", APPEND }, { "add", FRONT }, { "add", RANDOM },
+    { "del", APPEND }, { "del", FRONT }, { "del", RANDOM },
+    { "delRange", APPEND }, { "delRange", FRONT }, { "delRange", RANDOM },
+    { "addAll", APPEND },
+    { "pushPop", OSCILLATE },
+    { "reverse", APPEND },
+    { "clear", APPEND },
+};
+
+unsigned long long rng;
+uint64_t overhead;
+uint64_t *samples;
+
+/**
+ * xorshift64* pseudo random numbers.
+ *
+ * @param void
+ * @return unsigned long
+ */
+unsigned long nextRandom(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+/**
+ * @param void
+ * @return uint64_t: monotonic time in nanoseconds
+ */
+uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * The elements are never dereferenced, so fake non NULL pointers are used
+ * and nothing has to be allocated or freed.
+ *
+ * @param void* data
+ * @return void
+ */
+void freeFn(void *data)
+{
+}
+
+void* element(unsigned long i)
+{
+    return (void *) (uintptr_t) (i + 1);
+}
+
+/**
+ * Resets the peak resident set size of the process, if supported.
+ *
+ * @param void
+ * @return void
+ */
+void resetPeakRss(void)
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if(fp)
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+/**
+ * @param void
+ * @return long: peak resident set size in kB
+ */
+long peakRss(void)
+{
+    char line[128];
+    long kb = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    if(fp)
+    {
+        while(fgets(line, sizeof(line), fp))
+        {
+            if(sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        }
+        fclose(fp);
+    }
+    if(kb < 0)
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        kb = usage.ru_maxrss;
+    }
+    return kb;
+}
+
+int compareSamples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Measures the median cost of reading the clock twice.
+ *
+ * @param void
+ * @return uint64_t: overhead in nanoseconds
+ */
+uint64_t timerOverhead(void)
+{
+    int i;
+    for(i = 0; i < 1001; i++)
+    {
+        uint64_t start = now();
+        samples[i] = now() - start;
+    }
+    qsort(samples, 1001, sizeof(uint64_t), compareSamples);
+    return samples[500];
+}
+
+/**
+ * Creates a list of a specific size, untimed.
+ *
+ * @param unsigned long size
+ * @return AL*
+ */
+AL* build(unsigned long size)
+{
+    AL *list = al_create(MIN_SIZE);
+    list->freeFn = freeFn;
+
+    unsigned long i;
+    for(i = 0; i < size; i++)
+    {
+        al_push(list, element(i));
+    }
+    return list;
+}
+
+/**
+ * @param enum Pattern pattern
+ * @param unsigned long size: number of valid indices
+ * @return unsigned long: index for the next operation
+ */
+unsigned long pick(enum Pattern pattern, unsigned long size)
+{
+    switch(pattern)
+    {
+        case FRONT:
+            return 0;
+        case RANDOM:
+            return size ? nextRandom() % size : 0;
+        default:
+            return size ? size - 1 : 0;
+    }
+}
+
+/**
+ * Number of operations for a benchmark, so that operations moving the
+ * whole list stay within a fixed amount of work.
+ *
+ * @param Benchmark *b
+ * @param unsigned long size
+ * @param unsigned long ops: requested number of operations
+ * @return unsigned long
+ */
+unsigned long opsFor(Benchmark *b, unsigned long size, unsigned long ops)
+{
+    unsigned long limit = ops;
+
+    if(!strcmp(b->op, "reverse") || !strcmp(b->op, "clear"))
+        limit = LIST_WORK / (size + 1);
+    else if(b->pattern != APPEND && (!strcmp(b->op, "add") || !strcmp(b->op, "del") || !strcmp(b->op, "delRange")))
+        limit = SHIFT_WORK / (size + 1);
+
+    if(limit < 3)
+        limit = 3;
+    return limit < ops ? limit : ops;
+}
+
+/**
+ * Runs a benchmark and prints its CSV line.
+ *
+ * @param Benchmark *b
+ * @param unsigned long size: initial size of the list
+ * @param unsigned long ops: requested number of operations
+ * @return void
+ */
+void run(Benchmark *b, unsigned long size, unsigned long ops)
+{
+    ops = opsFor(b, size, ops);
+
+    resetPeakRss();
+    AL *list = build(size);
+
+    unsigned long stride = ops > MAX_SAMPLES ? (ops + MAX_SAMPLES - 1) / MAX_SAMPLES : 1;
+    unsigned long count = 0, i;
+    uint64_t total = 0, start, elapsed;
+    int down = 1;
+
+    for(i = 0; i < ops; i++)
+    {
+        const char *op = b->op;
+        unsigned long index;
+
+        /* untimed preparation */
+        if((!strcmp(op, "pop") || !strcmp(op, "del") || !strcmp(op, "get") || !strcmp(op, "set"))
+            && list->size == 0)
+        {
+            al_clear(list);
+            free(list);
+            list = build(size ? size : 1);
+        }
+        if(!strcmp(op, "delRange") && list->size < RANGE_SIZE)
+        {
+            al_clear(list);
+            free(list);
+            list = build(size > RANGE_SIZE ? size : RANGE_SIZE);
+        }
+        if(!strcmp(op, "clear") && !list->array)
+        {
+            free(list);
+            list = build(size);
+        }
+
+        void **data = NULL;
+        if(!strcmp(op, "addAll"))
+        {
+            data = malloc(sizeof(void *) * RANGE_SIZE);
+            unsigned long j;
+            for(j = 0; j < RANGE_SIZE; j++)
+            {
+                data[j] = element(j);
+            }
+        }
+
+        if(!strcmp(op, "delRange"))
+            index = pick(b->pattern, list->size - RANGE_SIZE + 1);
+        else if(!strcmp(op, "add") && b->pattern == APPEND)
+            index = list->size;
+        else
+            index = pick(b->pattern, list->size);
+
+        if(!strcmp(op, "pushPop"))
+        {
+            /* swing between the size and a third of it, across the shrink threshold */
+            if(list->size <= size / DEL_THRESHOLD)
+                down = 0;
+            else if(list->size >= size)
+                down = 1;
+        }
+
+        /* timed operation */
+        start = now();
+        if(!strcmp(op, "push"))
+            al_push(list, element(i));
+        else if(!strcmp(op, "pop"))
+            al_pop(list);
+        else if(!strcmp(op, "get"))
+            al_get(list, index);
+        else if(!strcmp(op, "set"))
+            al_set(list, index, element(i));
+        else if(!strcmp(op, "add"))
+            al_add(list, index, element(i));
+        else if(!strcmp(op, "del"))
+            al_del(list, index);
+        else if(!strcmp(op, "delRange"))
+            al_delRange(list, index, index + RANGE_SIZE - 1);
+        else if(!strcmp(op, "addAll"))
+            al_addAll(list, RANGE_SIZE, data);
+        else if(!strcmp(op, "pushPop") && down)
+            al_pop(list);
+        else if(!strcmp(op, "pushPop"))
+            al_push(list, element(i));
+        else if(!strcmp(op, "reverse"))
+            al_reverse(list);
+        else if(!strcmp(op, "clear"))
+            al_clear(list);
+        elapsed = now() - start;
+
+        /* untimed: inserts and deletes inside the list are undone to keep its size */
+        if(b->pattern == FRONT || b->pattern == RANDOM)
+        {
+            if(!strcmp(op, "add"))
+                al_del(list, index);
+            else if(!strcmp(op, "del"))
+                al_add(list, index, element(i));
+            else if(!strcmp(op, "delRange"))
+            {
+                data = malloc(sizeof(void *) * RANGE_SIZE);
+                unsigned long j;
+                for(j = 0; j < RANGE_SIZE; j++)
+                {
+                    data[j] = element(j);
+                }
+                al_addAll(list, RANGE_SIZE, data);
+            }
+        }
+
+        elapsed = elapsed > overhead ? elapsed - overhead : 0;
+        total += elapsed;
+        if(i % stride == 0)
+            samples[count++] = elapsed;
+    }
+
+    long rss = peakRss();
+
+    qsort(samples, count, sizeof(uint64_t), compareSamples);
+    printf("%s,%s,%lu,%lu,%.1f,%lu,%lu,%lu,%ld\n",
+        b->op, patterns[b->pattern], size, ops, (double) total / ops,
+        (unsigned long) samples[count * 50 / 100],
+        (unsigned long) samples[count * 99 / 100],
+        (unsigned long) samples[count * 999 / 1000],
+        rss);
+    fflush(stdout);
+
+    if(list->array)
+        al_clear(list);
+    free(list);
+}
+
+/**
+ * Main:
+ * Runs all benchmarks for all sizes.
+ *
+ * @param int argc: number of arguments
+ * @param char const *argv[]: pointer to arguments
+ * @return int: success
+ */
+int main(int argc, char *argv[])
+{
+    const char *sizes = DEFAULT_SIZES;
+    unsigned long ops = DEFAULT_OPS;
+    int opt;
+
+    rng = 88172645463325252ULL;
+    while((opt = getopt(argc, argv, "s:o:r:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's': sizes = optarg; break;
+            case 'o': ops = strtoul(optarg, NULL, 10); break;
+            case 'r': rng = strtoull(optarg, NULL, 10) | 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-s 10,1000,...] [-o ops] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(ops == 0)
+        ops = 1;
+
+    samples = malloc(sizeof(uint64_t) * MAX_SAMPLES);
+    overhead = timerOverhead();
+
+    puts("op,pattern,size,ops,ns_per_op,p50_ns,p99_ns,p999_ns,peak_rss_kb");
+
+    char *list = strdup(sizes), *token;
+    for(token = strtok(list, ","); token; token = strtok(NULL, ","))
+    {
+        unsigned long size = strtoul(token, NULL, 10);
+        unsigned long i;
+        for(i = 0; i < sizeof(benchmarks) / sizeof(Benchmark); i++)
+        {
+            run(&benchmarks[i], size, ops);
+        }
+    }
+
+    free(list);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,525 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+/* uncomment to ignore the assertions (no debug) */
+// #define NDEBUG
+#include <assert.h>
+
+#include "cl.h"
+
+/*
+ * Column list: a list of fixed size records stored as a structure of
+ * arrays. Every field of the schema has its own column, a contiguous array
+ * aligned to CL_ALIGNMENT bytes, so a scan over a field reads only that
+ * field and the loops over a column can be vectorized by the compiler.
+ *
+ * Records are passed in and out packed: the fields in schema order without
+ * padding. cl_column gives direct access to a column.
+ *
+ * The integer helpers (cl_sum, cl_filter and cl_sortPermutation without
+ * compareFn) treat a field of 1, 2, 4 or 8 bytes as a signed integer in
+ * native byte order.
+ */
+
+typedef struct SortContext
+{
+	const char *column;
+	unsigned long size;
+	int (*compareFn)(const void*, const void*);
+} SortContext;
+
+static char* allocColumn(unsigned long size);
+static int resize(CL *list, unsigned long memory_size);
+static int compareIndexes(const void *a, const void *b, void *arg);
+static uint64_t sortKey(const char *column, unsigned long size, unsigned long index);
+static unsigned long* radixPermutation(CL *list, unsigned int field);
+
+
+char* allocColumn(unsigned long size)
+{
+	void *column;
+	size = (size + CL_ALIGNMENT - 1) / CL_ALIGNMENT * CL_ALIGNMENT;
+	if(posix_memalign(&column, CL_ALIGNMENT, size ? size : CL_ALIGNMENT) != 0)
+		return NULL;
+	return column;
+}
+
+/*
+ * Move all columns to arrays of memory_size elements. realloc doesn't keep
+ * the alignment, so the columns are copied. Either all columns are moved
+ * or none.
+ */
+int resize(CL *list, unsigned long memory_size)
+{
+	char **new = malloc(sizeof(char *) * list->fields);
+	if(!new)
+		return -1;
+
+	unsigned int f;
+	for(f = 0; f < list->fields; f++)
+	{
+		new[f] = allocColumn(memory_size * list->field_sizes[f]);
+		if(!new[f])
+		{
+			while(f > 0)
+				free(new[--f]);
+			free(new);
+			return -1;
+		}
+	}
+
+	for(f = 0; f < list->fields; f++)
+	{
+		memcpy(new[f], list->columns[f], list->size * list->field_sizes[f]);
+		free(list->columns[f]);
+	}
+	free(list->columns);
+	list->columns = new;
+	list->memory_size = memory_size;
+	return 0;
+}
+
+/* ties are broken by index, which makes the permutation stable */
+int compareIndexes(const void *a, const void *b, void *arg)
+{
+	SortContext *context = arg;
+	unsigned long i = *(const unsigned long *) a, j = *(const unsigned long *) b;
+	int c = context->compareFn(context->column + i * context->size, context->column + j * context->size);
+	if(c)
+		return c;
+	return i < j ? -1 : i > j;
+}
+
+/* the value with flipped sign bit, which orders like the signed value */
+uint64_t sortKey(const char *column, unsigned long size, unsigned long index)
+{
+	switch(size)
+	{
+	case 1:
+		return (uint8_t) ((const int8_t *) column)[index] ^ 0x80;
+	case 2:
+		return (uint16_t) ((const int16_t *) column)[index] ^ 0x8000;
+	case 4:
+		return (uint32_t) ((const int32_t *) column)[index] ^ 0x80000000;
+	default:
+		return (uint64_t) ((const int64_t *) column)[index] ^ 0x8000000000000000ULL;
+	}
+}
+
+/*
+ * LSD radix sort of the indexes by an integer field, CL_SORT_BITS per pass.
+ * The keys travel with the indexes, so every pass reads sequentially.
+ * Passes over a digit which is the same for all keys are skipped.
+ */
+unsigned long* radixPermutation(CL *list, unsigned int field)
+{
+	unsigned long n = list->size, size = list->field_sizes[field];
+	unsigned long *permutation = malloc(sizeof(unsigned long) * (n ? n : 1));
+	unsigned long *indexes = malloc(sizeof(unsigned long) * (n ? n : 1));
+	uint64_t *keys = malloc(sizeof(uint64_t) * (n ? n : 1));
+	uint64_t *sorted = malloc(sizeof(uint64_t) * (n ? n : 1));
+	unsigned long counts[1 << CL_SORT_BITS];
+
+	if(!permutation || !indexes || !keys || !sorted)
+	{
+		free(permutation);
+		free(indexes);
+		free(keys);
+		free(sorted);
+		return NULL;
+	}
+
+	unsigned long i;
+	for(i = 0; i < n; i++)
+	{
+		permutation[i] = i;
+		keys[i] = sortKey(list->columns[field], size, i);
+	}
+
+	unsigned int shift;
+	for(shift = 0; shift < 8 * size; shift += CL_SORT_BITS)
+	{
+		memset(counts, 0, sizeof(counts));
+		for(i = 0; i < n; i++)
+		{
+			counts[(keys[i] >> shift) & ((1 << CL_SORT_BITS) - 1)]++;
+		}
+		if(n == 0 || counts[(keys[0] >> shift) & ((1 << CL_SORT_BITS) - 1)] == n)
+			continue;
+
+		unsigned long sum = 0, d;
+		for(d = 0; d < (1 << CL_SORT_BITS); d++)
+		{
+			unsigned long count = counts[d];
+			counts[d] = sum;
+			sum += count;
+		}
+		for(i = 0; i < n; i++)
+		{
+			unsigned long to = counts[(keys[i] >> shift) & ((1 << CL_SORT_BITS) - 1)]++;
+			indexes[to] = permutation[i];
+			sorted[to] = keys[i];
+		}
+
+		unsigned long *tmp = permutation;
+		permutation = indexes;
+		indexes = tmp;
+		uint64_t *tmp_keys = keys;
+		keys = sorted;
+		sorted = tmp_keys;
+	}
+
+	free(indexes);
+	free(keys);
+	free(sorted);
+	return permutation;
+}
+
+/*
+ * Create a column list.
+ *
+ * @param const unsigned long pointer to the sizes of the fields in bytes
+ * @param unsigned int number of fields
+ *
+ * @return CL pointer to the created column list or NULL on failure
+ */
+CL* cl_create(const unsigned long *field_sizes, unsigned int fields)
+{
+	assert(field_sizes);
+	assert(fields > 0);
+
+	CL *list = calloc(1, sizeof(CL));
+	if(!list)
+	{
+		puts("ERROR: Out of memory");
+		return NULL;
+	}
+
+	list->fields = fields;
+	list->field_sizes = malloc(sizeof(unsigned long) * fields);
+	list->offsets = malloc(sizeof(unsigned long) * fields);
+	list->columns = calloc(fields, sizeof(char *));
+	if(!list->field_sizes || !list->offsets || !list->columns)
+		goto fail;
+
+	unsigned int f;
+	for(f = 0; f < fields; f++)
+	{
+		assert(field_sizes[f] > 0);
+		list->field_sizes[f] = field_sizes[f];
+		list->offsets[f] = list->record_size;
+		list->record_size += field_sizes[f];
+		list->columns[f] = allocColumn(CL_MIN_SIZE * field_sizes[f]);
+		if(!list->columns[f])
+			goto fail;
+	}
+	list->memory_size = CL_MIN_SIZE;
+
+	return list;
+
+fail:
+	puts("ERROR: Out of memory");
+	cl_clear(list);
+	free(list);
+	return NULL;
+}
+
+/*
+ * @param CL pointer to the column list
+ * @param unsigned int field
+ *
+ * @return void pointer to the column of the field, aligned to CL_ALIGNMENT
+ */
+void* cl_column(CL *list, unsigned int field)
+{
+	assert(list);
+	assert(field < list->fields);
+
+	return list->columns[field];
+}
+
+/*
+ * @param CL pointer to the column list
+ * @param unsigned long index
+ * @param unsigned int field
+ *
+ * @return void pointer to the field of the record or NULL if it doesn't exist
+ */
+void* cl_field(CL *list, unsigned long index, unsigned int field)
+{
+	assert(list);
+	assert(field < list->fields);
+
+	if(index >= list->size)
+		return NULL;
+	return list->columns[field] + index * list->field_sizes[field];
+}
+
+/*
+ * Copy a record of the column list.
+ *
+ * @param CL pointer to the column list
+ * @param unsigned long index
+ * @param void pointer to record_size bytes receiving the packed record
+ *
+ * @return void pointer to the copied record or NULL if it doesn't exist
+ */
+void* cl_get(CL *list, unsigned long index, void *record)
+{
+	assert(list);
+	assert(record);
+
+	if(index >= list->size)
+		return NULL;
+
+	unsigned int f;
+	for(f = 0; f < list->fields; f++)
+	{
+		memcpy((char *) record + list->offsets[f], list->columns[f] + index * list->field_sizes[f], list->field_sizes[f]);
+	}
+	return record;
+}
+
+/*
+ * Change a record of the column list.
+ *
+ * @param CL pointer to the column list
+ * @param unsigned long index
+ * @param void pointer to the packed record
+ *
+ * @return void pointer to the new record or NULL if it doesn't exist
+ */
+const void* cl_set(CL *list, unsigned long index, const void *record)
+{
+	assert(list);
+	assert(record);
+
+	if(index >= list->size)
+		return NULL;
+
+	unsigned int f;
+	for(f = 0; f < list->fields; f++)
+	{
+		memcpy(list->columns[f] + index * list->field_sizes[f], (const char *) record + list->offsets[f], list->field_sizes[f]);
+	}
+	return record;
+}
+
+/*
+ * Push a record to the column list.
+ *
+ * @param CL pointer to the column list
+ * @param void pointer to the packed record
+ *
+ * @return unsigned long size of the column list
+ */
+unsigned long cl_push(CL *list, const void *record)
+{
+	assert(list);
+	assert(record);
+
+	if(list->size == list->memory_size && resize(list, list->memory_size * 2) < 0)
+	{
+		puts("ERROR: Out of memory");
+		return list->size;
+	}
+
+	list->size++;
+	cl_set(list, list->size - 1, record);
+	return list->size;
+}
+
+/*
+ * Remove a record of the column list at a specific index.
+ *
+ * @param CL pointer to the column list
+ * @param unsigned long index
+ * @param void pointer to record_size bytes receiving the packed record or NULL
+ *
+ * @return void pointer to the removed record or NULL if it doesn't exist
+ */
+void* cl_del(CL *list, unsigned long index, void *record)
+{
+	assert(list);
+
+	if(index >= list->size)
+		return NULL;
+
+	if(record)
+		cl_get(list, index, record);
+
+	unsigned int f;
+	for(f = 0; f < list->fields; f++)
+	{
+		unsigned long size = list->field_sizes[f];
+		memmove(list->columns[f] + index * size, list->columns[f] + (index + 1) * size, (list->size - index - 1) * size);
+	}
+	list->size--;
+
+	/* failing to shrink is harmless */
+	if(3 * list->size <= list->memory_size && list->memory_size > CL_MIN_SIZE)
+		resize(list, list->memory_size / 2);
+
+	return record;
+}
+
+/*
+ * Sum of an integer field.
+ *
+ * @param CL pointer to the column list
+ * @param unsigned int field of 1, 2, 4 or 8 bytes
+ *
+ * @return long sum of the field over all records
+ */
+long cl_sum(CL *list, unsigned int field)
+{
+	assert(list);
+	assert(field < list->fields);
+
+	const char *column = list->columns[field];
+	unsigned long n = list->size, i;
+	long sum = 0;
+
+#define CL_SUM(type) { const type *values = (const type *) column; for(i = 0; i < n; i++) sum += values[i]; }
+	switch(list->field_sizes[field])
+	{
+	case 1: CL_SUM(int8_t) break;
+	case 2: CL_SUM(int16_t) break;
+	case 4: CL_SUM(int32_t) break;
+	case 8: CL_SUM(int64_t) break;
+	default: assert(0);
+	}
+#undef CL_SUM
+
+	return sum;
+}
+
+/*
+ * Find the records whose integer field lies in [low, high]. The loop has no
+ * branches on the values.
+ *
+ * @param CL pointer to the column list
+ * @param unsigned int field of 1, 2, 4 or 8 bytes
+ * @param long lowest value
+ * @param long highest value
+ * @param unsigned long pointer to room for size indexes receiving the matches in order
+ *
+ * @return unsigned long number of matches
+ */
+unsigned long cl_filter(CL *list, unsigned int field, long low, long high, unsigned long *indexes)
+{
+	assert(list);
+	assert(field < list->fields);
+	assert(indexes || list->size == 0);
+
+	const char *column = list->columns[field];
+	unsigned long n = list->size, count = 0, i;
+
+#define CL_FILTER(type) { const type *values = (const type *) column; for(i = 0; i < n; i++) { indexes[count] = i; count += (values[i] >= low) & (values[i] <= high); } }
+	switch(list->field_sizes[field])
+	{
+	case 1: CL_FILTER(int8_t) break;
+	case 2: CL_FILTER(int16_t) break;
+	case 4: CL_FILTER(int32_t) break;
+	case 8: CL_FILTER(int64_t) break;
+	default: assert(0);
+	}
+#undef CL_FILTER
+
+	return count;
+}
+
+/*
+ * Compute the order of the records by a field without moving them.
+ * Without compareFn the field is sorted as an integer by radix sort in
+ * O(n), otherwise compareFn gets pointers to two field values.
+ * The permutation is stable.
+ *
+ * @param CL pointer to the column list
+ * @param unsigned int field
+ * @param function pointer to the compare callback or NULL
+ *
+ * @return unsigned long pointer to size indexes in sorted order (to be freed) or NULL on failure
+ */
+unsigned long* cl_sortPermutation(CL *list, unsigned int field, int (*compareFn)(const void*, const void*))
+{
+	assert(list);
+	assert(field < list->fields);
+
+	if(!compareFn)
+	{
+		assert(list->field_sizes[field] == 1 || list->field_sizes[field] == 2 || list->field_sizes[field] == 4 || list->field_sizes[field] == 8);
+		return radixPermutation(list, field);
+	}
+
+	unsigned long *permutation = malloc(sizeof(unsigned long) * (list->size ? list->size : 1));
+	if(!permutation)
+		return NULL;
+
+	unsigned long i;
+	for(i = 0; i < list->size; i++)
+	{
+		permutation[i] = i;
+	}
+
+	SortContext context = { list->columns[field], list->field_sizes[field], compareFn };
+	qsort_r(permutation, list->size, sizeof(unsigned long), compareIndexes, &context);
+	return permutation;
+}
+
+/*
+ * Deallocate the columns of the column list.
+ *
+ * @param CL pointer to the column list
+ *
+ * @return void
+ */
+void cl_clear(CL *list)
+{
+	assert(list);
+
+	unsigned int f;
+	for(f = 0; list->columns && f < list->fields; f++)
+	{
+		free(list->columns[f]);
+	}
+	free(list->columns);
+	free(list->field_sizes);
+	free(list->offsets);
+	list->columns = NULL;
+	list->field_sizes = NULL;
+	list->offsets = NULL;
+	list->size = 0;
+	list->memory_size = 0;
+}
+
+/*
+ * Print the column list to the console.
+ *
+ * @param CL pointer to the column list
+ *
+ * @return void
+ */
+void cl_print(CL *list)
+{
+	assert(list);
+	assert(list->printFn);
+
+	char *record = malloc(list->record_size);
+	if(!record)
+	{
+		puts("ERROR: Out of memory");
+		return;
+	}
+
+	unsigned long i;
+	for(i = 0; i < list->size; i++)
+	{
+		printf("index: %ld data: ", i);
+		list->printFn(cl_get(list, i, record));
+	}
+	puts("---");
+	free(record);
+}
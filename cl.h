@@ -0,0 +1,33 @@
+#ifndef CL_H
+#define CL_H
+
+#define CL_ALIGNMENT 64
+#define CL_MIN_SIZE 16
+#define CL_SORT_BITS 8
+
+typedef struct ColumnList
+{
+	unsigned long size;
+	unsigned long memory_size;
+	unsigned int fields;
+	unsigned long *field_sizes;
+	unsigned long *offsets;
+	unsigned long record_size;
+	char **columns;
+	void (*printFn)(const void*);
+} CL;
+
+CL* cl_create(const unsigned long *field_sizes, unsigned int fields);
+void* cl_column(CL *list, unsigned int field);
+void* cl_field(CL *list, unsigned long index, unsigned int field);
+void* cl_get(CL *list, unsigned long index, void *record);
+const void* cl_set(CL *list, unsigned long index, const void *record);
+unsigned long cl_push(CL *list, const void *record);
+void* cl_del(CL *list, unsigned long index, void *record);
+long cl_sum(CL *list, unsigned int field);
+unsigned long cl_filter(CL *list, unsigned int field, long low, long high, unsigned long *indexes);
+unsigned long* cl_sortPermutation(CL *list, unsigned int field, int (*compareFn)(const void*, const void*));
+void cl_clear(CL *list);
+void cl_print(CL *list);
+
+#endif
@@ -0,0 +1,641 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+/* uncomment to ignore the assertions (no debug) */
+// #define NDEBUG
+#include <assert.h>
+
+#include "dl.h"
+
+#define MIN_PAGES 64
+#define NO_PAGE ((unsigned long) -1)
+
+/*
+ * Disk list: an array list of fixed size elements which lives in a local
+ * file. Element i is stored at byte i * element_size of the file, which is
+ * split into pages of page_size bytes. A pool of cache_pages page frames in
+ * memory caches the pages in LRU order.
+ *
+ * Dirty pages are written back when they are evicted; the kernel is asked to
+ * start the write-out without waiting for it. Sequential scans are detected
+ * and the following pages are read ahead asynchronously.
+ */
+
+static int readPage(DL *list, unsigned long page, char *buffer);
+static int writeBack(DL *list, long frame);
+static void unlinkFrame(DL *list, long frame);
+static void linkFrame(DL *list, long frame);
+static char* fetch(DL *list, unsigned long page, int write);
+static void invalidate(DL *list);
+static int sortRuns(DL *list, unsigned long run);
+static int merge(DL *list, int src, int dst, unsigned long start, unsigned long width, unsigned long fanin);
+
+
+int readPage(DL *list, unsigned long page, char *buffer)
+{
+	unsigned long done = 0;
+
+	if(page < list->disk_pages)
+	{
+		while(done < list->page_size)
+		{
+			ssize_t n = pread(list->fd, buffer + done, list->page_size - done, page * list->page_size + done);
+			if(n < 0)
+				return -1;
+			if(n == 0)
+				break;
+			done += n;
+		}
+	}
+	memset(buffer + done, 0, list->page_size - done);
+
+	return 0;
+}
+
+int writeBack(DL *list, long frame)
+{
+	DLFrame *f = &list->frames[frame];
+	if(!f->dirty)
+		return 0;
+
+	off_t offset = f->page * list->page_size;
+	char *buffer = list->pool + frame * list->page_size;
+	unsigned long done = 0;
+	while(done < list->page_size)
+	{
+		ssize_t n = pwrite(list->fd, buffer + done, list->page_size - done, offset + done);
+		if(n < 0)
+			return -1;
+		done += n;
+	}
+#ifdef SYNC_FILE_RANGE_WRITE
+	sync_file_range(list->fd, offset, list->page_size, SYNC_FILE_RANGE_WRITE);
+#endif
+
+	f->dirty = 0;
+	if(f->page >= list->disk_pages)
+		list->disk_pages = f->page + 1;
+
+	return 0;
+}
+
+void unlinkFrame(DL *list, long frame)
+{
+	DLFrame *f = &list->frames[frame];
+
+	if(f->prev >= 0)
+		list->frames[f->prev].next = f->next;
+	else
+		list->head = f->next;
+	if(f->next >= 0)
+		list->frames[f->next].prev = f->prev;
+	else
+		list->tail = f->prev;
+}
+
+void linkFrame(DL *list, long frame)
+{
+	DLFrame *f = &list->frames[frame];
+
+	f->prev = -1;
+	f->next = list->head;
+	if(list->head >= 0)
+		list->frames[list->head].prev = frame;
+	list->head = frame;
+	if(list->tail < 0)
+		list->tail = frame;
+}
+
+/*
+ * Return the cached page, loading it and evicting the least recently used
+ * page if necessary.
+ */
+char* fetch(DL *list, unsigned long page, int write)
+{
+	long frame = page < list->lookup_size ? list->lookup[page] : -1;
+
+	if(frame >= 0)
+	{
+		if(frame != list->head)
+		{
+			unlinkFrame(list, frame);
+			linkFrame(list, frame);
+		}
+	}
+	else
+	{
+		if(page >= list->lookup_size)
+		{
+			unsigned long size = list->lookup_size * 2;
+			while(size <= page)
+				size *= 2;
+			long *new = realloc(list->lookup, sizeof(long) * size);
+			if(!new)
+				return NULL;
+			unsigned long i;
+			for(i = list->lookup_size; i < size; i++)
+			{
+				new[i] = -1;
+			}
+			list->lookup = new;
+			list->lookup_size = size;
+		}
+
+		if(list->used < list->cache_pages)
+		{
+			frame = list->used++;
+		}
+		else
+		{
+			frame = list->tail;
+			if(writeBack(list, frame) < 0)
+				return NULL;
+			unlinkFrame(list, frame);
+			if(list->frames[frame].page != NO_PAGE)
+				list->lookup[list->frames[frame].page] = -1;
+		}
+
+		list->frames[frame].dirty = 0;
+		if(readPage(list, page, list->pool + frame * list->page_size) < 0)
+		{
+			/* keep the empty frame as the first one to be evicted */
+			list->frames[frame].page = NO_PAGE;
+			list->frames[frame].prev = list->tail;
+			list->frames[frame].next = -1;
+			if(list->tail >= 0)
+				list->frames[list->tail].next = frame;
+			else
+				list->head = frame;
+			list->tail = frame;
+			return NULL;
+		}
+		list->frames[frame].page = page;
+		list->lookup[page] = frame;
+		linkFrame(list, frame);
+
+		if(list->prefetch_pages && page == list->last_page + 1 && page + 1 < list->disk_pages)
+		{
+			posix_fadvise(list->fd, (page + 1) * list->page_size,
+				list->prefetch_pages * list->page_size, POSIX_FADV_WILLNEED);
+		}
+	}
+
+	list->last_page = page;
+	if(write)
+		list->frames[frame].dirty = 1;
+
+	return list->pool + frame * list->page_size;
+}
+
+void invalidate(DL *list)
+{
+	unsigned long i;
+	for(i = 0; i < list->lookup_size; i++)
+	{
+		list->lookup[i] = -1;
+	}
+	list->used = 0;
+	list->head = -1;
+	list->tail = -1;
+}
+
+/*
+ * Sort every run of the given number of elements in place, using the page
+ * pool as buffer.
+ */
+int sortRuns(DL *list, unsigned long run)
+{
+	unsigned long es = list->element_size;
+	unsigned long start;
+	for(start = 0; start < list->size; start += run)
+	{
+		unsigned long n = list->size - start < run ? list->size - start : run;
+		unsigned long bytes = n * es, done;
+
+		for(done = 0; done < bytes; )
+		{
+			ssize_t r = pread(list->fd, list->pool + done, bytes - done, start * es + done);
+			if(r <= 0)
+				return -1;
+			done += r;
+		}
+
+		qsort(list->pool, n, es, (int (*)(const void*, const void*)) list->compareFn);
+
+		for(done = 0; done < bytes; )
+		{
+			ssize_t w = pwrite(list->fd, list->pool + done, bytes - done, start * es + done);
+			if(w < 0)
+				return -1;
+			done += w;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Merge up to fanin sorted runs of width elements, beginning at element
+ * start of src, into the same range of dst. Every run and the output get a
+ * slice of the page pool as buffer.
+ */
+int merge(DL *list, int src, int dst, unsigned long start, unsigned long width, unsigned long fanin)
+{
+	unsigned long es = list->element_size;
+	unsigned long slice = (list->cache_pages * list->page_size / (fanin + 1)) / es;
+	unsigned long *lo = malloc(sizeof(unsigned long) * fanin * 5);
+	unsigned long *hi = lo + fanin, *pos = hi + fanin, *fill = pos + fanin, *heap = fill + fanin;
+	unsigned long heap_size = 0;
+	int ret = -1;
+	char *out = list->pool + fanin * slice * es;
+	unsigned long out_fill = 0, out_pos = start;
+	unsigned long k;
+
+	if(!lo)
+		return -1;
+
+	for(k = 0; k < fanin; k++)
+	{
+		lo[k] = start + k * width;
+		hi[k] = lo[k] + width < list->size ? lo[k] + width : list->size;
+		pos[k] = fill[k] = 0;
+		if(lo[k] >= list->size)
+			break;
+	}
+	fanin = k;
+
+	#define HEAD(k) (list->pool + ((k) * slice + pos[k]) * es)
+	#define LESS(a, b) (list->compareFn(HEAD(heap[a]), HEAD(heap[b])) < 0)
+
+	for(k = 0; k < fanin; k++)
+	{
+		/* refill the buffer of run k, then sift it up into the heap */
+		unsigned long n = hi[k] - lo[k] < slice ? hi[k] - lo[k] : slice;
+		if(pread(src, list->pool + k * slice * es, n * es, lo[k] * es) != (ssize_t) (n * es))
+			goto done;
+		lo[k] += n;
+		fill[k] = n;
+
+		unsigned long i = heap_size++;
+		heap[i] = k;
+		while(i > 0 && LESS(i, (i - 1) / 2))
+		{
+			unsigned long tmp = heap[i];
+			heap[i] = heap[(i - 1) / 2];
+			heap[(i - 1) / 2] = tmp;
+			i = (i - 1) / 2;
+		}
+	}
+
+	while(heap_size > 0)
+	{
+		k = heap[0];
+		memcpy(out + out_fill * es, HEAD(k), es);
+		if(++out_fill == slice)
+		{
+			if(pwrite(dst, out, out_fill * es, out_pos * es) != (ssize_t) (out_fill * es))
+				goto done;
+			out_pos += out_fill;
+			out_fill = 0;
+		}
+
+		if(++pos[k] == fill[k])
+		{
+			unsigned long n = hi[k] - lo[k] < slice ? hi[k] - lo[k] : slice;
+			if(n > 0)
+			{
+				if(pread(src, list->pool + k * slice * es, n * es, lo[k] * es) != (ssize_t) (n * es))
+					goto done;
+				lo[k] += n;
+				fill[k] = n;
+				pos[k] = 0;
+			}
+			else
+			{
+				heap[0] = heap[--heap_size];
+			}
+		}
+
+		unsigned long i = 0;
+		for(;;)
+		{
+			unsigned long l = 2 * i + 1, r = l + 1, min = i;
+			if(l < heap_size && LESS(l, min))
+				min = l;
+			if(r < heap_size && LESS(r, min))
+				min = r;
+			if(min == i)
+				break;
+			unsigned long tmp = heap[i];
+			heap[i] = heap[min];
+			heap[min] = tmp;
+			i = min;
+		}
+	}
+
+	#undef LESS
+	#undef HEAD
+
+	if(out_fill && pwrite(dst, out, out_fill * es, out_pos * es) != (ssize_t) (out_fill * es))
+		goto done;
+	ret = 0;
+
+done:
+	free(lo);
+	return ret;
+}
+
+/*
+ * Create a disk list backed by a file. An existing file is truncated.
+ *
+ * @param const char pointer to the file name
+ * @param unsigned long size of an element in bytes
+ * @param unsigned long page size in bytes, rounded down to whole elements
+ * @param unsigned long number of pages cached in memory (at least 3)
+ *
+ * @return DL pointer to the created disk list or NULL on failure
+ */
+DL* dl_create(const char *path, unsigned long element_size, unsigned long page_size, unsigned long cache_pages)
+{
+	assert(path);
+	assert(element_size > 0);
+	assert(cache_pages >= 3);
+
+	if(page_size < element_size)
+		page_size = element_size;
+	page_size -= page_size % element_size;
+
+	DL *new = malloc(sizeof(DL));
+	char *pool = malloc(page_size * cache_pages);
+	DLFrame *frames = malloc(sizeof(DLFrame) * cache_pages);
+	long *lookup = malloc(sizeof(long) * MIN_PAGES);
+	char *copy = strdup(path);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if(!new || !pool || !frames || !lookup || !copy || fd < 0)
+	{
+		if(fd < 0)
+			perror(path);
+		else
+			puts("ERROR: Out of memory");
+		if(fd >= 0)
+			close(fd);
+		free(new);
+		free(pool);
+		free(frames);
+		free(lookup);
+		free(copy);
+		return NULL;
+	}
+
+	new->fd = fd;
+	new->path = copy;
+	new->size = 0;
+	new->element_size = element_size;
+	new->page_size = page_size;
+	new->cache_pages = cache_pages;
+	new->prefetch_pages = DL_PREFETCH_PAGES;
+	new->disk_pages = 0;
+	new->last_page = 0;
+	new->pool = pool;
+	new->frames = frames;
+	new->lookup = lookup;
+	new->lookup_size = MIN_PAGES;
+	new->compareFn = NULL;
+	new->printFn = NULL;
+	invalidate(new);
+
+	return new;
+}
+
+/*
+ * Copy an element of the disk list.
+ *
+ * @param DL pointer to the disk list
+ * @param unsigned long index
+ * @param void pointer to element_size bytes receiving the element
+ *
+ * @return void pointer to the copied element or NULL if it doesn't exist
+ */
+void* dl_get(DL *list, unsigned long index, void *data)
+{
+	assert(list);
+	assert(data);
+
+	if(index >= list->size)
+		return NULL;
+
+	unsigned long offset = index * list->element_size;
+	char *page = fetch(list, offset / list->page_size, 0);
+	if(!page)
+		return NULL;
+
+	memcpy(data, page + offset % list->page_size, list->element_size);
+	return data;
+}
+
+/*
+ * Change an element of the disk list.
+ *
+ * @param DL pointer to the disk list
+ * @param unsigned long index
+ * @param void pointer to the new element
+ *
+ * @return void pointer to the new element or NULL if it doesn't exist
+ */
+const void* dl_set(DL *list, unsigned long index, const void *data)
+{
+	assert(list);
+	assert(data);
+
+	if(index >= list->size)
+		return NULL;
+
+	unsigned long offset = index * list->element_size;
+	char *page = fetch(list, offset / list->page_size, 1);
+	if(!page)
+		return NULL;
+
+	memcpy(page + offset % list->page_size, data, list->element_size);
+	return data;
+}
+
+/*
+ * Push an element to the disk list.
+ *
+ * @param DL pointer to the disk list
+ * @param void pointer to the element
+ *
+ * @return unsigned long size of the disk list
+ */
+unsigned long dl_push(DL *list, const void *data)
+{
+	assert(list);
+	assert(data);
+
+	unsigned long offset = list->size * list->element_size;
+	char *page = fetch(list, offset / list->page_size, 1);
+	if(page)
+	{
+		memcpy(page + offset % list->page_size, data, list->element_size);
+		list->size++;
+	}
+	return list->size;
+}
+
+/*
+ * Pop an element from the disk list.
+ *
+ * @param DL pointer to the disk list
+ * @param void pointer to element_size bytes receiving the element
+ *
+ * @return void pointer to the removed element or NULL if it doesn't exist
+ */
+void* dl_pop(DL *list, void *data)
+{
+	assert(list);
+
+	if(list->size == 0 || !dl_get(list, list->size - 1, data))
+		return NULL;
+
+	list->size--;
+	return data;
+}
+
+/*
+ * Write all dirty pages to the file.
+ *
+ * @param DL pointer to the disk list
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int dl_flush(DL *list)
+{
+	assert(list);
+
+	long frame;
+	for(frame = list->head; frame >= 0; frame = list->frames[frame].next)
+	{
+		if(writeBack(list, frame) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Sort the disk list with compareFn using an external merge sort: runs as
+ * big as the page cache are sorted in memory, then merged with a fan-in of
+ * cache_pages - 1 per pass.
+ *
+ * @param DL pointer to the disk list
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int dl_sort(DL *list)
+{
+	assert(list);
+	assert(list->compareFn);
+
+	if(dl_flush(list) < 0)
+		return -1;
+	invalidate(list);
+	if(ftruncate(list->fd, list->size * list->element_size) < 0)
+		return -1;
+	list->disk_pages = (list->size * list->element_size + list->page_size - 1) / list->page_size;
+
+	unsigned long run = list->cache_pages * list->page_size / list->element_size;
+	if(sortRuns(list, run) < 0)
+		return -1;
+	if(list->size <= run)
+		return 0;
+
+	unsigned long length = strlen(list->path);
+	char tmp_path[length + 8];
+	memcpy(tmp_path, list->path, length);
+	strcpy(tmp_path + length, ".XXXXXX");
+	int tmp = mkstemp(tmp_path);
+	if(tmp < 0)
+		return -1;
+
+	unsigned long fanin = list->cache_pages - 1;
+	unsigned long width, start;
+	int src = list->fd, dst = tmp;
+	for(width = run; width < list->size; width *= fanin)
+	{
+		for(start = 0; start < list->size; start += width * fanin)
+		{
+			if(merge(list, src, dst, start, width, fanin) < 0)
+			{
+				close(tmp);
+				unlink(tmp_path);
+				return -1;
+			}
+		}
+		int swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if(src == tmp)
+	{
+		if(rename(tmp_path, list->path) < 0)
+		{
+			close(tmp);
+			unlink(tmp_path);
+			return -1;
+		}
+		close(list->fd);
+		list->fd = tmp;
+	}
+	else
+	{
+		close(tmp);
+		unlink(tmp_path);
+	}
+	return 0;
+}
+
+/*
+ * Close the disk list and deallocate its memory. The file is truncated.
+ *
+ * @param DL pointer to the disk list
+ *
+ * @return void
+ */
+void dl_clear(DL *list)
+{
+	assert(list);
+
+	if(ftruncate(list->fd, 0) < 0)
+		perror(list->path);
+	close(list->fd);
+	free(list->path);
+	free(list->pool);
+	free(list->frames);
+	free(list->lookup);
+	free(list);
+}
+
+/*
+ * Print the disk list to the console.
+ *
+ * @param DL pointer to the disk list
+ *
+ * @return void
+ */
+void dl_print(DL *list)
+{
+	assert(list);
+	assert(list->printFn);
+
+	char data[list->element_size];
+	unsigned long i;
+	for(i = 0; i < list->size; i++)
+	{
+		printf("index: %ld data: ", i);
+		list->printFn(dl_get(list, i, data));
+	}
+	puts("---");
+}
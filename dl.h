@@ -0,0 +1,48 @@
+#ifndef DL_H
+#define DL_H
+
+#define DL_PAGE_SIZE (1 << 16)
+#define DL_CACHE_PAGES 256
+#define DL_PREFETCH_PAGES 8
+
+typedef struct DiskListFrame
+{
+	unsigned long page;
+	int dirty;
+	long prev;
+	long next;
+} DLFrame;
+
+typedef struct DiskList
+{
+	int fd;
+	char *path;
+	unsigned long size;
+	unsigned long element_size;
+	unsigned long page_size;
+	unsigned long cache_pages;
+	unsigned long prefetch_pages;
+	unsigned long disk_pages;
+	unsigned long last_page;
+	char *pool;
+	DLFrame *frames;
+	unsigned long used;
+	long head;
+	long tail;
+	long *lookup;
+	unsigned long lookup_size;
+	int (*compareFn)(void*, void*);
+	void (*printFn)(void*);
+} DL;
+
+DL* dl_create(const char *path, unsigned long element_size, unsigned long page_size, unsigned long cache_pages);
+void* dl_get(DL *list, unsigned long index, void *data);
+const void* dl_set(DL *list, unsigned long index, const void *data);
+unsigned long dl_push(DL *list, const void *data);
+void* dl_pop(DL *list, void *data);
+int dl_flush(DL *list);
+int dl_sort(DL *list);
+void dl_clear(DL *list);
+void dl_print(DL *list);
+
+#endif
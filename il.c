@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+/* uncomment to ignore the assertions (no debug) */
+// #define NDEBUG
+#include <assert.h>
+
+#include "il.h"
+
+/*
+ * Integer list: a compressed list of 64 bit integers for sorted or
+ * clustered values.
+ *
+ * The values are stored in blocks of IL_BLOCK_SIZE. A block keeps its
+ * first value and the differences to the previous value minus their
+ * minimum (frame of reference), bit-packed
+ * with the width of the largest of them. A block of width b takes 2 * b
+ * words, the block table holds the offsets and acts as a skip index, so an
+ * element is found by decoding a single block. The last decoded block is
+ * cached, which makes sequential access O(1).
+ *
+ * Appended values are collected uncompressed in the tail until a block is
+ * full. Unpacking, the frame of reference and the scan kernels are
+ * branch-free loops over a block. The makefile builds il.o with -O3, where
+ * GCC vectorizes the frame of reference and il_sum loops, unpacking stays
+ * scalar.
+ */
+
+static int encode(IL *list);
+static void unpack(const uint64_t *data, unsigned int bits, uint64_t *deltas);
+static void decodeBlock(IL *list, unsigned long block, int64_t *values);
+
+
+/*
+ * Compress the full tail into a new block.
+ */
+int encode(IL *list)
+{
+	uint64_t deltas[IL_BLOCK_SIZE];
+	int64_t min = INT64_MAX;
+	unsigned int i;
+
+	for(i = 1; i < IL_BLOCK_SIZE; i++)
+	{
+		deltas[i] = (uint64_t) list->tail[i] - (uint64_t) list->tail[i-1];
+		if((int64_t) deltas[i] < min)
+			min = deltas[i];
+	}
+
+	/* the first difference isn't stored, it is 0 for the packing */
+	uint64_t all = 0;
+	deltas[0] = (uint64_t) min;
+	for(i = 0; i < IL_BLOCK_SIZE; i++)
+	{
+		deltas[i] -= (uint64_t) min;
+		all |= deltas[i];
+	}
+	unsigned int bits = all ? 64 - __builtin_clzll(all) : 0;
+	unsigned long words = 2 * bits;
+
+	if(list->blocks_size == list->blocks_memory)
+	{
+		unsigned long memory = list->blocks_memory ? list->blocks_memory * 2 : IL_MIN_BLOCKS;
+		ILBlock *blocks = realloc(list->blocks, sizeof(ILBlock) * memory);
+		if(!blocks)
+			return -1;
+		list->blocks = blocks;
+		list->blocks_memory = memory;
+	}
+	/* one word of padding for the unpacking */
+	if(list->data_size + words + 1 > list->data_memory)
+	{
+		unsigned long memory = list->data_memory * 2;
+		if(memory < list->data_size + words + 1)
+			memory = list->data_size + words + 1;
+		uint64_t *data = realloc(list->data, sizeof(uint64_t) * memory);
+		if(!data)
+			return -1;
+		list->data = data;
+		list->data_memory = memory;
+	}
+
+	uint64_t *data = list->data + list->data_size;
+	memset(data, 0, sizeof(uint64_t) * (words + 1));
+	for(i = 0; bits && i < IL_BLOCK_SIZE; i++)
+	{
+		unsigned long position = (unsigned long) i * bits;
+		unsigned int shift = position % 64;
+		data[position / 64] |= deltas[i] << shift;
+		if(shift + bits > 64)
+			data[position / 64 + 1] |= deltas[i] >> (64 - shift);
+	}
+
+	ILBlock *block = &list->blocks[list->blocks_size++];
+	block->first = list->tail[0];
+	block->min_delta = min;
+	block->offset = list->data_size;
+	block->bits = bits;
+	list->data_size += words;
+	list->tail_size = 0;
+	return 0;
+}
+
+/*
+ * Unpack the IL_BLOCK_SIZE values of a block of the given width. Values
+ * crossing a word boundary take their high bits from the next word,
+ * without a branch.
+ */
+void unpack(const uint64_t *data, unsigned int bits, uint64_t *deltas)
+{
+	unsigned int i;
+
+	if(bits == 0)
+	{
+		memset(deltas, 0, sizeof(uint64_t) * IL_BLOCK_SIZE);
+		return;
+	}
+
+	uint64_t mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+	for(i = 0; i < IL_BLOCK_SIZE; i++)
+	{
+		unsigned long position = (unsigned long) i * bits;
+		unsigned int shift = position % 64;
+		const uint64_t *word = data + position / 64;
+		deltas[i] = ((word[0] >> shift) | ((word[1] << 1) << (63 - shift))) & mask;
+	}
+}
+
+void decodeBlock(IL *list, unsigned long block, int64_t *values)
+{
+	ILBlock *b = &list->blocks[block];
+	uint64_t deltas[IL_BLOCK_SIZE];
+	unsigned int i;
+
+	unpack(list->data + b->offset, b->bits, deltas);
+	for(i = 1; i < IL_BLOCK_SIZE; i++)
+	{
+		deltas[i] += (uint64_t) b->min_delta;
+	}
+
+	uint64_t value = b->first;
+	values[0] = value;
+	for(i = 1; i < IL_BLOCK_SIZE; i++)
+	{
+		value += deltas[i];
+		values[i] = value;
+	}
+}
+
+/*
+ * Create an integer list.
+ *
+ * @return IL pointer to the created integer list or NULL on failure
+ */
+IL* il_create(void)
+{
+	IL *list = calloc(1, sizeof(IL));
+	if(!list)
+	{
+		puts("ERROR: Out of memory");
+		return NULL;
+	}
+	list->cached_block = -1;
+	return list;
+}
+
+/*
+ * Push a value to the integer list.
+ *
+ * @param IL pointer to the integer list
+ * @param int64_t value
+ *
+ * @return unsigned long size of the integer list
+ */
+unsigned long il_push(IL *list, int64_t value)
+{
+	assert(list);
+
+	list->tail[list->tail_size++] = value;
+	list->size++;
+
+	if(list->tail_size == IL_BLOCK_SIZE && encode(list) < 0)
+	{
+		puts("ERROR: Out of memory");
+		list->tail_size--;
+		list->size--;
+	}
+	return list->size;
+}
+
+/*
+ * Pop a value from the integer list.
+ *
+ * @param IL pointer to the integer list
+ * @param int64_t pointer receiving the value
+ *
+ * @return int64_t pointer to the removed value or NULL if it doesn't exist
+ */
+int64_t* il_pop(IL *list, int64_t *value)
+{
+	assert(list);
+	assert(value);
+
+	if(list->size == 0)
+		return NULL;
+
+	/* the last block becomes the tail again */
+	if(list->tail_size == 0)
+	{
+		unsigned long block = list->blocks_size - 1;
+		decodeBlock(list, block, list->tail);
+		list->data_size = list->blocks[block].offset;
+		list->blocks_size--;
+		list->tail_size = IL_BLOCK_SIZE;
+		if(list->cached_block == (long) block)
+			list->cached_block = -1;
+	}
+
+	*value = list->tail[--list->tail_size];
+	list->size--;
+	return value;
+}
+
+/*
+ * Access a value of the integer list.
+ *
+ * @param IL pointer to the integer list
+ * @param unsigned long index
+ * @param int64_t pointer receiving the value
+ *
+ * @return int64_t pointer to the value or NULL if it doesn't exist
+ */
+int64_t* il_get(IL *list, unsigned long index, int64_t *value)
+{
+	assert(list);
+	assert(value);
+
+	if(index >= list->size)
+		return NULL;
+
+	unsigned long block = index / IL_BLOCK_SIZE;
+	if(block == list->blocks_size)
+	{
+		*value = list->tail[index % IL_BLOCK_SIZE];
+		return value;
+	}
+
+	if(list->cached_block != (long) block)
+	{
+		decodeBlock(list, block, list->cache);
+		list->cached_block = block;
+	}
+	*value = list->cache[index % IL_BLOCK_SIZE];
+	return value;
+}
+
+/*
+ * Decode a range of the integer list. Whole blocks are decoded directly
+ * into the output.
+ *
+ * @param IL pointer to the integer list
+ * @param unsigned long index of the first value
+ * @param unsigned long number of values
+ * @param int64_t pointer to room for count values
+ *
+ * @return unsigned long number of decoded values
+ */
+unsigned long il_decode(IL *list, unsigned long start, unsigned long count, int64_t *values)
+{
+	assert(list);
+	assert(values || count == 0);
+
+	if(start >= list->size)
+		return 0;
+	if(count > list->size - start)
+		count = list->size - start;
+
+	unsigned long done = 0;
+	while(done < count)
+	{
+		unsigned long index = start + done;
+		unsigned long block = index / IL_BLOCK_SIZE, offset = index % IL_BLOCK_SIZE;
+		unsigned long n = IL_BLOCK_SIZE - offset < count - done ? IL_BLOCK_SIZE - offset : count - done;
+
+		if(block == list->blocks_size)
+		{
+			memcpy(values + done, list->tail + offset, sizeof(int64_t) * n);
+		}
+		else if(offset == 0 && n == IL_BLOCK_SIZE)
+		{
+			decodeBlock(list, block, values + done);
+		}
+		else
+		{
+			if(list->cached_block != (long) block)
+			{
+				decodeBlock(list, block, list->cache);
+				list->cached_block = block;
+			}
+			memcpy(values + done, list->cache + offset, sizeof(int64_t) * n);
+		}
+		done += n;
+	}
+	return count;
+}
+
+/*
+ * Sum of all values (wrapping on overflow). A block is summed from its
+ * packed differences without the prefix sum: the difference at position
+ * k is part of the IL_BLOCK_SIZE - k values behind it.
+ *
+ * @param IL pointer to the integer list
+ *
+ * @return int64_t sum of the values
+ */
+int64_t il_sum(IL *list)
+{
+	assert(list);
+
+	uint64_t sum = 0, deltas[IL_BLOCK_SIZE];
+	unsigned long block;
+	unsigned int i;
+
+	for(block = 0; block < list->blocks_size; block++)
+	{
+		ILBlock *b = &list->blocks[block];
+		unpack(list->data + b->offset, b->bits, deltas);
+
+		uint64_t weighted = 0, total = 0;
+		for(i = 1; i < IL_BLOCK_SIZE; i++)
+		{
+			weighted += deltas[i] * (IL_BLOCK_SIZE - i);
+			total += IL_BLOCK_SIZE - i;
+		}
+		sum += (uint64_t) b->first * IL_BLOCK_SIZE + weighted + (uint64_t) b->min_delta * total;
+	}
+	for(i = 0; i < list->tail_size; i++)
+	{
+		sum += list->tail[i];
+	}
+	return sum;
+}
+
+/*
+ * @param IL pointer to the integer list
+ *
+ * @return unsigned long number of bytes allocated by the integer list
+ */
+unsigned long il_memory(IL *list)
+{
+	assert(list);
+
+	return sizeof(IL) + sizeof(ILBlock) * list->blocks_memory + sizeof(uint64_t) * list->data_memory;
+}
+
+/*
+ * Deallocate memory of the integer list.
+ *
+ * @param IL pointer to the integer list
+ *
+ * @return void
+ */
+void il_clear(IL *list)
+{
+	assert(list);
+
+	free(list->blocks);
+	free(list->data);
+	list->blocks = NULL;
+	list->data = NULL;
+	list->size = 0;
+	list->blocks_size = 0;
+	list->blocks_memory = 0;
+	list->data_size = 0;
+	list->data_memory = 0;
+	list->tail_size = 0;
+	list->cached_block = -1;
+}
+
+/*
+ * Print the integer list to the console.
+ *
+ * @param IL pointer to the integer list
+ *
+ * @return void
+ */
+void il_print(IL *list)
+{
+	assert(list);
+
+	unsigned long i;
+	int64_t value;
+	for(i = 0; i < list->size; i++)
+	{
+		printf("index: %ld data: %ld\n", i, (long) *il_get(list, i, &value));
+	}
+	puts("---");
+}
@@ -0,0 +1,42 @@
+#ifndef IL_H
+#define IL_H
+
+#include <stdint.h>
+
+#define IL_BLOCK_SIZE 128
+#define IL_MIN_BLOCKS 16
+
+typedef struct IntListBlock
+{
+	int64_t first;
+	int64_t min_delta;
+	unsigned long offset;
+	unsigned int bits;
+} ILBlock;
+
+typedef struct IntList
+{
+	unsigned long size;
+	ILBlock *blocks;
+	unsigned long blocks_size;
+	unsigned long blocks_memory;
+	uint64_t *data;
+	unsigned long data_size;
+	unsigned long data_memory;
+	int64_t tail[IL_BLOCK_SIZE];
+	unsigned int tail_size;
+	int64_t cache[IL_BLOCK_SIZE];
+	long cached_block;
+} IL;
+
+IL* il_create(void);
+unsigned long il_push(IL *list, int64_t value);
+int64_t* il_pop(IL *list, int64_t *value);
+int64_t* il_get(IL *list, unsigned long index, int64_t *value);
+unsigned long il_decode(IL *list, unsigned long start, unsigned long count, int64_t *values);
+int64_t il_sum(IL *list);
+unsigned long il_memory(IL *list);
+void il_clear(IL *list);
+void il_print(IL *list);
+
+#endif
@@ -29,11 +29,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "al.h"
 
 AL *list;
-int *d1, *d2;
+FILE *record;
 
 /**
  * Prints the usage options.
@@ -49,6 +53,7 @@ void usage(void)
     puts("next\t\tprint the next node");
     puts("prev\t\tprint the previous node");
     puts("print (p)\tprint the list");
+    puts("dump\t\twrite the list to stdout, one integer per line");
     puts("info (i)\tprint list info");
     puts("hasNext\t\tprint if list has a next node");
     puts("hasPrev\t\tprint if list has a previous node");
@@ -70,6 +75,10 @@ void usage(void)
     puts("\t\t(modes: 1=head to tail, 2=tail to head, 3=head and tail)");
     puts("sad 10 1|2|3\tsearch and delete an integer in the list with a specific search");
     puts("\t\tmode (modes: 1=head to tail, 2=tail to head, 3=head and tail)");
+    puts("");
+    puts("options:");
+    puts("-r oplog\treplay an op log and print the throughput");
+    puts("-w oplog\trecord the session as op log");
 }
 
 /**
@@ -160,6 +169,20 @@ void executeGpl(int nargs, char *command, char option)
 
 
 
+/**
+ * Reads the monotonic clock.
+ *
+ * @param void
+ * @return double: seconds
+ */
+double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
 /* =========================== User defined code =========================== */
 
 /**
@@ -192,6 +215,26 @@ void printFn(void *data)
         printf("%p\n", data);
 }
 
+/**
+ * This callback function is feed with the data pointer and a buffer to
+ * format the data into. It returns the length of the text, if the buffer
+ * is too small nothing is written and the required length is returned.
+ *
+ * @param void* data
+ * @param char* buffer
+ * @param unsigned long size: size of the buffer
+ * @return unsigned long
+ */
+unsigned long formatFn(void *data, char *buffer, unsigned long size)
+{
+    char text[24];
+    unsigned long length = snprintf(text, sizeof(text), "%d\n", *(int *) data);
+
+    if(length <= size)
+        memcpy(buffer, text, length);
+    return length;
+}
+
 /**
  * This callback function is feed with the data pointer to free the data.
  *
@@ -228,13 +271,55 @@ int compareFn(void *first_arg, void *second_arg)
         return 1;
 }
 
+/**
+ * Allocates an integer to be stored in the list.
+ *
+ * @param int value
+ * @return void*
+ */
+void* integer(int value)
+{
+    int *data = malloc(sizeof(int));
+    *data = value;
+    return data;
+}
+
+/**
+ * Prints the size of the list and, if compiled with AL_STATS, its statistics.
+ *
+ * @param AL *list
+ * @return void
+ */
 void info(AL *list)
 {
     printf("--- Info ---\n");
     printf("memory size: %ld\n", list->memory_size);
     printf("size: %ld\n", list->size);
+
+    const ALStats *stats = al_stats(list);
+    if(stats)
+    {
+        printf("grows: %ld\n", stats->grows);
+        printf("shrinks: %ld\n", stats->shrinks);
+        printf("elements moved: %ld\n", stats->moved);
+        printf("bytes allocated: %ld\n", stats->bytes_allocated);
+        printf("peak memory size: %ld\n", stats->peak_memory_size);
+        printf("freeFn calls: %ld\n", stats->frees);
+    }
+#ifdef AL_STATS_LATENCY
+    const char *names[AL_OPS] = { "get", "set", "push", "pop", "add", "del", "delRange", "addAll", "reverse", "clear" };
+    int op, bucket;
+    for(op = 0; op < AL_OPS; op++)
+    {
+        for(bucket = 0; bucket < AL_STATS_BUCKETS; bucket++)
+        {
+            if(stats->latency[op][bucket])
+                printf("%s < %llu ns: %ld\n", names[op], 1ULL << bucket, stats->latency[op][bucket]);
+        }
+    }
+#endif
     printf("---\n");
-} 
+}
 
 /**
  * Performs some tests with a dynamic number of elements.
@@ -324,20 +409,15 @@ void perform(int elements)
  */
 void fill(int beg, int end)
 {
-    int *integer;
-    void *data;
     int i;
 
-    clock_t start = clock();
+    double start = seconds();
 
     if(beg > end)
     {
         for(i = beg; i >= end; i--)
         {
-            integer = malloc(sizeof(int));
-            *integer = i;
-            data = integer;
-            al_push(list, data);
+            al_push(list, integer(i));
         }
 
     }
@@ -345,14 +425,11 @@ void fill(int beg, int end)
     {
         for(i = beg; i <= end; i++)
         {
-            integer = malloc(sizeof(int));
-            *integer = i;
-            data = integer;
-            al_push(list, data);
+            al_push(list, integer(i));
         }
     }
 
-    double elapsed = ( (double)clock() - start ) / CLOCKS_PER_SEC;
+    double elapsed = seconds() - start;
     printf("Filling finished in %f s\n", elapsed);
 }
 
@@ -367,17 +444,6 @@ void fill(int beg, int end)
  */
 void executeAl(int nargs, char *command, int arg1, int arg2)
 {
-    d1 = malloc(sizeof(int));
-    d2 = malloc(sizeof(int));
-
-    *d1 = arg1;
-    *d2 = arg2;
-
-    void *a1, *a2;
-
-    a1 = d1;
-    a2 = d2;
-
     if(!list)
     {
         list = al_create(10);
@@ -439,6 +505,11 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
             {
                 al_print(list);
             }
+            else if(!strcmp(command, "dump"))
+            {
+                fflush(stdout);
+                al_write(list, STDOUT_FILENO, formatFn);
+            }
             else if(!strcmp(command, "info") || !strcmp(command, "i"))
             {
                 info(list);
@@ -450,6 +521,7 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
                     printf("%d\n", *(int *) data);
                 else
                     printf("%p\n", data);
+                free(data);
             }
             else if(!strcmp(command, "reverse"))
             {
@@ -469,13 +541,14 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
             // }
             else if(!strcmp(command, "clear"))
             {
-                clock_t start = clock();
+                double start = seconds();
 
                 al_clear(list);
 
-                double elapsed = ( (double)clock() - start ) / CLOCKS_PER_SEC;
+                double elapsed = seconds() - start;
                 printf("Clearing finished in %f s\n", elapsed);
 
+                free(list);
                 list = NULL;
             }
             else if(!strcmp(command, "show"))
@@ -490,7 +563,7 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
         case 2:
             if(!strcmp(command, "get"))
             {
-                void *data = al_get(list, *d1);
+                void *data = al_get(list, arg1);
                 if(data)
                     printFn(data);
                 else
@@ -498,7 +571,7 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
             }
             else if(!strcmp(command, "push"))
             {
-                al_push(list, a1);
+                al_push(list, integer(arg1));
             }
             // else if(!strcmp(command, "pushHead") || !strcmp(command, "puh"))
             // {
@@ -510,7 +583,7 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
             // }
             else if(!strcmp(command, "del"))
             {
-                al_del(list, *d1);
+                free(al_del(list, arg1));
             }
             // else if(!strcmp(command, "find"))
             // {
@@ -539,15 +612,17 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
         case 3:
             if(!strcmp(command, "set"))
             {
-                al_set(list, *d1, a2);
+                void *data = integer(arg2);
+                void *old = al_set(list, arg1, data);
+                free(old ? old : data);
             }
             else if(!strcmp(command, "add"))
             {
-                al_add(list, *d1, a2);
+                al_add(list, arg1, integer(arg2));
             }
             else if(!strcmp(command, "delr"))
             {
-                al_delRange(list, *d1, *d2);
+                al_delRange(list, arg1, arg2);
             }
             // else if(!strcmp(command, "before"))
             // {
@@ -593,6 +668,316 @@ void executeAl(int nargs, char *command, int arg1, int arg2)
     }
 }
 
+/* ============================== Replay mode ============================== */
+
+/**
+ * An op log is a text file with one command per line, in the same syntax
+ * as the interactive commands (e.g. a session recorded with -w). Replaying
+ * parses the whole log up front, then executes the list commands without
+ * any per command allocation: the integers are taken from one pool.
+ * Other commands are skipped.
+ */
+
+enum { R_PUSH, R_POP, R_GET, R_SET, R_ADD, R_DEL, R_DELR, R_FILL, R_REVERSE, R_CLEAR, R_COMMANDS };
+
+const char *replayCommands[R_COMMANDS] = { "push", "pop", "get", "set", "add", "del", "delr", "fill", "reverse", "clear" };
+const int replayArgs[R_COMMANDS] = { 1, 0, 1, 2, 2, 1, 2, 2, 0, 0 };
+
+typedef struct ReplayOp
+{
+    int command;
+    int arg1;
+    int arg2;
+} ReplayOp;
+
+/**
+ * The pool owns the integers of a replay, so the list must not free them.
+ *
+ * @param void* data
+ * @return void
+ */
+void keepFn(void *data)
+{
+    (void) data;
+}
+
+/**
+ * Parses one line of an op log.
+ *
+ * @param const char *line
+ * @param unsigned long length
+ * @param ReplayOp *op: parsed command
+ * @return int: 1 if the line is a list command, 0 otherwise
+ */
+int parseOp(const char *line, unsigned long length, ReplayOp *op)
+{
+    unsigned long i = 0, n;
+    while(i < length && (line[i] == ' ' || line[i] == '\t'))
+        i++;
+
+    const char *command = line + i;
+    while(i < length && line[i] != ' ' && line[i] != '\t' && line[i] != '\r')
+        i++;
+    unsigned long command_length = line + i - command;
+
+    for(op->command = 0; op->command < R_COMMANDS; op->command++)
+    {
+        if(strlen(replayCommands[op->command]) == command_length
+            && !memcmp(replayCommands[op->command], command, command_length))
+            break;
+    }
+    if(op->command == R_COMMANDS)
+        return 0;
+
+    long value;
+    op->arg1 = op->arg2 = 0;
+    if(replayArgs[op->command] >= 1)
+    {
+        if(!(n = al_parseLong(line + i, length - i, &value)))
+            return 0;
+        op->arg1 = value;
+        i += n;
+    }
+    if(replayArgs[op->command] >= 2)
+    {
+        if(!(n = al_parseLong(line + i, length - i, &value)))
+            return 0;
+        op->arg2 = value;
+    }
+
+    /* indexes can't be negative, a range has to be ordered */
+    if(op->command == R_GET || op->command == R_SET || op->command == R_ADD
+        || op->command == R_DEL || op->command == R_DELR)
+    {
+        if(op->arg1 < 0)
+            return 0;
+    }
+    if(op->command == R_DELR && op->arg1 > op->arg2)
+        return 0;
+    return 1;
+}
+
+/**
+ * Creates the list of a replay.
+ *
+ * @param void
+ * @return AL*: the list or NULL if out of memory
+ */
+AL* replayList(void)
+{
+    AL *new = al_create(10);
+    if(new)
+    {
+        new->compareFn = compareFn;
+        new->freeFn = keepFn;
+        new->printFn = printFn;
+    }
+    return new;
+}
+
+/**
+ * Executes one command of a replay. Stored integers are taken from the pool.
+ *
+ * @param ReplayOp *op: command
+ * @param int *pool: integers of the replay
+ * @param unsigned long *next: next free integer of the pool
+ * @param long *checksum: sum of the values read by get
+ * @return int: 0 on success, -1 if out of memory
+ */
+int replayOp(ReplayOp *op, int *pool, unsigned long *next, long *checksum)
+{
+    void *data;
+    int v;
+
+    switch(op->command)
+    {
+        case R_PUSH:
+            pool[*next] = op->arg1;
+            al_push(list, &pool[(*next)++]);
+            break;
+        case R_POP:
+            al_pop(list);
+            break;
+        case R_GET:
+            if( (data = al_get(list, op->arg1)) )
+                *checksum += *(int *) data;
+            break;
+        case R_SET:
+            pool[*next] = op->arg2;
+            al_set(list, op->arg1, &pool[(*next)++]);
+            break;
+        case R_ADD:
+            pool[*next] = op->arg2;
+            al_add(list, op->arg1, &pool[(*next)++]);
+            break;
+        case R_DEL:
+            al_del(list, op->arg1);
+            break;
+        case R_DELR:
+            if((unsigned long) op->arg2 < list->size)
+                al_delRange(list, op->arg1, op->arg2);
+            break;
+        case R_FILL:
+            for(v = op->arg1; ; v += op->arg1 > op->arg2 ? -1 : 1)
+            {
+                pool[*next] = v;
+                al_push(list, &pool[(*next)++]);
+                if(v == op->arg2)
+                    break;
+            }
+            break;
+        case R_REVERSE:
+            al_reverse(list);
+            break;
+        case R_CLEAR:
+            al_clear(list);
+            free(list);
+            if(!(list = replayList()))
+                return -1;
+            break;
+    }
+    return 0;
+}
+
+/**
+ * Measures the cost of reading the clock twice, which is subtracted from
+ * every timed run of commands.
+ *
+ * @param void
+ * @return double: seconds
+ */
+double timerOverhead(void)
+{
+    int i, n = 1000;
+    double start = seconds();
+    for(i = 0; i < n; i++)
+        seconds();
+    return 2 * (seconds() - start) / n;
+}
+
+/**
+ * Replays an op log and prints the throughput in total and per command.
+ * Consecutive commands of the same type are timed as one run, so the clock
+ * isn't read around every single command.
+ *
+ * @param const char *file: file name of the op log
+ * @return int: success
+ */
+int replay(const char *file)
+{
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0)
+    {
+        printf("Cannot open file '%s'\n", file);
+        return 1;
+    }
+
+    char *text = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if(text == MAP_FAILED)
+    {
+        printf("Cannot map file '%s'\n", file);
+        return 1;
+    }
+    madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+    /* count the lines to allocate the ops at once */
+    unsigned long lines = 1, count = 0, skipped = 0, values = 0;
+    const char *p, *end = text + st.st_size;
+    for(p = text; p < end && (p = memchr(p, '\n', end - p)); p++)
+        lines++;
+
+    ReplayOp *ops = malloc(sizeof(ReplayOp) * lines);
+    if(!ops)
+    {
+        if(text)
+            munmap(text, st.st_size);
+        puts("ERROR: Out of memory");
+        return 1;
+    }
+    for(p = text; p < end; )
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        if(!eol)
+            eol = end;
+
+        if(parseOp(p, eol - p, &ops[count]))
+        {
+            ReplayOp *op = &ops[count++];
+            if(op->command == R_PUSH || op->command == R_SET || op->command == R_ADD)
+                values++;
+            else if(op->command == R_FILL)
+                values += labs((long) op->arg2 - op->arg1) + 1;
+        }
+        else if(eol > p)
+        {
+            skipped++;
+        }
+        p = eol + 1;
+    }
+    if(text)
+        munmap(text, st.st_size);
+
+    int *pool = malloc(sizeof(int) * (values ? values : 1));
+    if(!pool || !(list = replayList()))
+    {
+        puts("ERROR: Out of memory");
+        free(pool);
+        free(ops);
+        return 1;
+    }
+    unsigned long next = 0, executed[R_COMMANDS] = { 0 }, i = 0, runs = 0;
+    double elapsed[R_COMMANDS] = { 0 };
+    double overhead = timerOverhead();
+    long checksum = 0;
+
+    double start = seconds();
+    while(i < count)
+    {
+        int command = ops[i].command;
+        unsigned long first = i;
+        double begin = seconds();
+        for(; i < count && ops[i].command == command; i++)
+        {
+            if(replayOp(&ops[i], pool, &next, &checksum) < 0)
+            {
+                puts("ERROR: Out of memory");
+                free(pool);
+                free(ops);
+                return 1;
+            }
+        }
+        elapsed[command] += seconds() - begin - overhead;
+        executed[command] += i - first;
+        runs++;
+    }
+    double total = seconds() - start - runs * overhead;
+    if(total < 0)
+        total = 0;
+
+    printf("Replayed %ld commands in %f s (%.0f commands/s), skipped %ld lines\n",
+        count, total, total > 0 ? count / total : 0, skipped);
+    printf("checksum of get: %ld\n", checksum);
+    puts("command,count,seconds,ns/command");
+    int c;
+    for(c = 0; c < R_COMMANDS; c++)
+    {
+        if(elapsed[c] < 0)
+            elapsed[c] = 0;
+        if(executed[c])
+            printf("%s,%ld,%f,%.1f\n", replayCommands[c], executed[c],
+                elapsed[c], elapsed[c] * 1e9 / executed[c]);
+    }
+
+    al_clear(list);
+    free(list);
+    list = NULL;
+    free(pool);
+    free(ops);
+    return 0;
+}
+
 /**
  * Extracts the commands out of a line and executes them.
  *
@@ -621,14 +1006,38 @@ void parseLine(char *line, size_t *nbytes)
  * Reads each line from stdin which is not an EOF.
  * Frees the allocated memory.
  *
+ * Options:
+ * -r file: replay an op log instead of reading stdin
+ * -w file: record the session as op log
+ *
  * @param int argc: number of arguments
- * @param char const *argv[]: pointer to arguments
+ * @param char *argv[]: pointer to arguments
  * @return int: success
  */
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
     size_t bytes_read;
     size_t nbytes = 8;
+    int opt;
+
+    while((opt = getopt(argc, argv, "r:w:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+                return replay(optarg);
+            case 'w':
+                if(!(record = fopen(optarg, "w")))
+                {
+                    printf("Cannot open file '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                printf("usage: %s [-r oplog] [-w oplog]\n", argv[0]);
+                return 1;
+        }
+    }
 
     char *line = (char *) malloc(nbytes + 1);
 
@@ -641,15 +1050,21 @@ int main(int argc, char const *argv[])
 
     while( (bytes_read = getline(&line, &nbytes, stdin)) != -1)
     {
+        if(record)
+            fputs(line, record);
         parseLine(line, &bytes_read);
     }
 
-    free(d1);
-    free(d2);
+    if(record)
+        fclose(record);
 
     free(line);
 
-    al_clear(list);
+    if(list)
+    {
+        al_clear(list);
+        free(list);
+    }
 
     return 0;
 }
@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+/* uncomment to ignore the assertions (no debug) */
+// #define NDEBUG
+#include <assert.h>
+
+#include "pv.h"
+
+/*
+ * Persistent vector: a 32-way radix balanced trie plus a tail buffer.
+ *
+ * Every version is a PV handle. Updates copy the O(log32 n) nodes on the
+ * path to the changed slot and share everything else with the previous
+ * version, so keeping many versions costs memory proportional to the
+ * changes. Nodes are reference counted and released together with the
+ * last version pointing to them.
+ *
+ * A transient (see pv_transient) owns the nodes it created itself and
+ * updates them in place, which makes bulk building about as cheap as
+ * pushing to an AL.
+ *
+ * The elements are shared between versions and are never freed by the
+ * vector, the caller owns them.
+ */
+
+static unsigned long edits = 0;
+
+static PVNode* newNode(unsigned long edit);
+static PVNode* retainNode(PVNode *node);
+static void releaseNode(PVNode *node, unsigned int level);
+static PVNode* editableNode(PV *pv, PVNode *node, unsigned int level);
+static PV* target(PV *pv);
+static unsigned long tailOffset(PV *pv);
+static PVNode* leafFor(PV *pv, unsigned long index);
+static PVNode* doSet(PV *pv, PVNode *node, unsigned int level, unsigned long index, void *data);
+static PVNode* newPath(PV *pv, unsigned int level, PVNode *node);
+static PVNode* pushTail(PV *pv, unsigned int level, PVNode *parent, PVNode *tail);
+static PVNode* popTail(PV *pv, unsigned int level, PVNode *node);
+
+
+PVNode* newNode(unsigned long edit)
+{
+	PVNode *node = calloc(1, sizeof(PVNode));
+	if(!node)
+	{
+		puts("ERROR: Out of memory");
+		exit(1);
+	}
+	node->refs = 1;
+	node->edit = edit;
+	return node;
+}
+
+PVNode* retainNode(PVNode *node)
+{
+	if(node)
+		node->refs++;
+	return node;
+}
+
+void releaseNode(PVNode *node, unsigned int level)
+{
+	if(!node || --node->refs)
+		return;
+
+	if(level > 0)
+	{
+		unsigned int i;
+		for(i = 0; i < PV_WIDTH; i++)
+		{
+			releaseNode(node->slots[i], level - PV_BITS);
+		}
+	}
+	free(node);
+}
+
+/*
+ * Return a node which may be modified by the given version: the node itself
+ * if it belongs to the transient, otherwise a copy holding its own
+ * references to the children.
+ */
+PVNode* editableNode(PV *pv, PVNode *node, unsigned int level)
+{
+	if(pv->edit && node->edit == pv->edit)
+		return node;
+
+	PVNode *copy = newNode(pv->edit);
+	unsigned int i;
+	for(i = 0; i < PV_WIDTH; i++)
+	{
+		copy->slots[i] = node->slots[i];
+		if(level > 0)
+			retainNode(copy->slots[i]);
+	}
+	return copy;
+}
+
+/*
+ * Return the version an update is applied to: a transient is updated in
+ * place, a persistent version gets a new handle sharing root and tail.
+ */
+PV* target(PV *pv)
+{
+	if(pv->edit)
+		return pv;
+
+	PV *new = malloc(sizeof(PV));
+	if(!new)
+	{
+		puts("ERROR: Out of memory");
+		exit(1);
+	}
+	*new = *pv;
+	new->refs = 1;
+	new->edit = 0;
+	retainNode(new->root);
+	retainNode(new->tail);
+	return new;
+}
+
+unsigned long tailOffset(PV *pv)
+{
+	if(pv->size < PV_WIDTH)
+		return 0;
+	return ((pv->size - 1) >> PV_BITS) << PV_BITS;
+}
+
+PVNode* leafFor(PV *pv, unsigned long index)
+{
+	if(index >= tailOffset(pv))
+		return pv->tail;
+
+	PVNode *node = pv->root;
+	unsigned int level;
+	for(level = pv->shift; level > 0; level -= PV_BITS)
+	{
+		node = node->slots[(index >> level) & PV_MASK];
+	}
+	return node;
+}
+
+PVNode* doSet(PV *pv, PVNode *node, unsigned int level, unsigned long index, void *data)
+{
+	PVNode *ret = editableNode(pv, node, level);
+
+	if(level == 0)
+	{
+		ret->slots[index & PV_MASK] = data;
+	}
+	else
+	{
+		unsigned int i = (index >> level) & PV_MASK;
+		PVNode *child = ret->slots[i];
+		PVNode *new = doSet(pv, child, level - PV_BITS, index, data);
+		if(new != child)
+		{
+			releaseNode(child, level - PV_BITS);
+			ret->slots[i] = new;
+		}
+	}
+	return ret;
+}
+
+PVNode* newPath(PV *pv, unsigned int level, PVNode *node)
+{
+	while(level > 0)
+	{
+		PVNode *parent = newNode(pv->edit);
+		parent->slots[0] = node;
+		node = parent;
+		level -= PV_BITS;
+	}
+	return node;
+}
+
+PVNode* pushTail(PV *pv, unsigned int level, PVNode *parent, PVNode *tail)
+{
+	unsigned int i = ((pv->size - 1) >> level) & PV_MASK;
+	PVNode *ret = editableNode(pv, parent, level);
+	PVNode *child = ret->slots[i];
+	PVNode *insert;
+
+	if(level == PV_BITS)
+		insert = tail;
+	else if(child)
+		insert = pushTail(pv, level - PV_BITS, child, tail);
+	else
+		insert = newPath(pv, level - PV_BITS, tail);
+
+	if(insert != child)
+	{
+		releaseNode(child, level - PV_BITS);
+		ret->slots[i] = insert;
+	}
+	return ret;
+}
+
+/*
+ * Remove the rightmost leaf from the subtree. Returns NULL if the subtree
+ * becomes empty.
+ */
+PVNode* popTail(PV *pv, unsigned int level, PVNode *node)
+{
+	unsigned int i = ((pv->size - 2) >> level) & PV_MASK;
+
+	if(level > PV_BITS)
+	{
+		PVNode *child = node->slots[i];
+		PVNode *new = popTail(pv, level - PV_BITS, child);
+		if(!new && i == 0)
+			return NULL;
+
+		PVNode *ret = editableNode(pv, node, level);
+		if(new != child)
+		{
+			releaseNode(child, level - PV_BITS);
+			ret->slots[i] = new;
+		}
+		return ret;
+	}
+	else if(i == 0)
+	{
+		return NULL;
+	}
+	else
+	{
+		PVNode *ret = editableNode(pv, node, level);
+		releaseNode(ret->slots[i], 0);
+		ret->slots[i] = NULL;
+		return ret;
+	}
+}
+
+/*
+ * Create an empty persistent vector.
+ *
+ * @return PV pointer to the created version
+ */
+PV* pv_create(void)
+{
+	PV *new = malloc(sizeof(PV));
+	if(!new)
+	{
+		puts("ERROR: Out of memory");
+		exit(1);
+	}
+
+	new->refs = 1;
+	new->size = 0;
+	new->shift = PV_BITS;
+	new->edit = 0;
+	new->root = newNode(0);
+	new->tail = newNode(0);
+	new->printFn = NULL;
+
+	return new;
+}
+
+/*
+ * Build a persistent vector holding the elements of an array list.
+ *
+ * @param AL pointer to the array list
+ *
+ * @return PV pointer to the created version
+ */
+PV* pv_fromAL(AL *list)
+{
+	assert(list);
+
+	PV *empty = pv_create();
+	PV *pv = pv_transient(empty);
+	pv_release(empty);
+
+	/* read through the iterator, the list may be mapped, sparse or hold tombstones */
+	ALIter iter;
+	al_iterInit(list, &iter);
+	void **span;
+	unsigned long count, i;
+	while((count = al_nextSpan(&iter, &span)) > 0)
+	{
+		for(i = 0; i < count; i++)
+		{
+			pv_push(pv, span[i]);
+		}
+	}
+	pv->printFn = list->printFn;
+
+	return pv_persistent(pv);
+}
+
+/*
+ * Take another reference to a version.
+ *
+ * @param PV pointer to the version
+ *
+ * @return PV pointer to the same version
+ */
+PV* pv_retain(PV *pv)
+{
+	assert(pv);
+
+	pv->refs++;
+	return pv;
+}
+
+/*
+ * Drop a reference to a version. Nodes not shared with any other version
+ * are released with it.
+ *
+ * @param PV pointer to the version
+ *
+ * @return void
+ */
+void pv_release(PV *pv)
+{
+	if(!pv || --pv->refs)
+		return;
+
+	releaseNode(pv->root, pv->shift);
+	releaseNode(pv->tail, 0);
+	free(pv);
+}
+
+/*
+ * Create a transient copy of a persistent version for batch updates.
+ * Updates on a transient are applied in place and return the transient
+ * itself. The original version stays unchanged.
+ *
+ * @param PV pointer to the version
+ *
+ * @return PV pointer to the transient
+ */
+PV* pv_transient(PV *pv)
+{
+	assert(pv);
+	assert(!pv->edit);
+
+	PV *new = target(pv);
+	new->edit = ++edits;
+
+	return new;
+}
+
+/*
+ * Turn a transient into a persistent version. The transient must not be
+ * updated through another handle afterwards.
+ *
+ * @param PV pointer to the transient
+ *
+ * @return PV pointer to the persistent version
+ */
+PV* pv_persistent(PV *pv)
+{
+	assert(pv);
+
+	pv->edit = 0;
+	return pv;
+}
+
+/*
+ * @param PV pointer to the version
+ *
+ * @return unsigned long number of elements
+ */
+unsigned long pv_size(PV *pv)
+{
+	assert(pv);
+
+	return pv->size;
+}
+
+/*
+ * Access an element of a version.
+ *
+ * @param PV pointer to the version
+ * @param unsigned long index
+ *
+ * @return void pointer to the element or NULL if it doesn't exist
+ */
+void* pv_get(PV *pv, unsigned long index)
+{
+	assert(pv);
+
+	if(index >= pv->size)
+		return NULL;
+	return leafFor(pv, index)->slots[index & PV_MASK];
+}
+
+/*
+ * Change an element.
+ *
+ * @param PV pointer to the version
+ * @param unsigned long index
+ * @param void pointer with the new data
+ *
+ * @return PV pointer to the new version or NULL if the index doesn't exist
+ */
+PV* pv_set(PV *pv, unsigned long index, void *data)
+{
+	assert(pv);
+
+	if(index >= pv->size)
+		return NULL;
+
+	PV *ret = target(pv);
+	if(index >= tailOffset(ret))
+	{
+		PVNode *tail = editableNode(ret, ret->tail, 0);
+		tail->slots[index & PV_MASK] = data;
+		if(tail != ret->tail)
+		{
+			releaseNode(ret->tail, 0);
+			ret->tail = tail;
+		}
+	}
+	else
+	{
+		PVNode *root = doSet(ret, ret->root, ret->shift, index, data);
+		if(root != ret->root)
+		{
+			releaseNode(ret->root, ret->shift);
+			ret->root = root;
+		}
+	}
+	return ret;
+}
+
+/*
+ * Push an element to the end.
+ *
+ * @param PV pointer to the version
+ * @param void pointer to the data
+ *
+ * @return PV pointer to the new version
+ */
+PV* pv_push(PV *pv, void *data)
+{
+	assert(pv);
+
+	PV *ret = target(pv);
+	if(ret->size - tailOffset(ret) < PV_WIDTH)
+	{
+		PVNode *tail = editableNode(ret, ret->tail, 0);
+		tail->slots[ret->size & PV_MASK] = data;
+		if(tail != ret->tail)
+		{
+			releaseNode(ret->tail, 0);
+			ret->tail = tail;
+		}
+	}
+	else
+	{
+		/* the full tail moves into the trie, its reference with it */
+		PVNode *root;
+		if((ret->size >> PV_BITS) > (1UL << ret->shift))
+		{
+			root = newNode(ret->edit);
+			root->slots[0] = ret->root;
+			root->slots[1] = newPath(ret, ret->shift, ret->tail);
+			ret->shift += PV_BITS;
+		}
+		else
+		{
+			root = pushTail(ret, ret->shift, ret->root, ret->tail);
+			if(root != ret->root)
+				releaseNode(ret->root, ret->shift);
+		}
+		ret->root = root;
+		ret->tail = newNode(ret->edit);
+		ret->tail->slots[0] = data;
+	}
+	ret->size++;
+
+	return ret;
+}
+
+/*
+ * Remove the last element.
+ *
+ * @param PV pointer to the version
+ *
+ * @return PV pointer to the new version or NULL if the version is empty
+ */
+PV* pv_pop(PV *pv)
+{
+	assert(pv);
+
+	if(pv->size == 0)
+		return NULL;
+
+	PV *ret = target(pv);
+	if(ret->size - tailOffset(ret) > 1)
+	{
+		PVNode *tail = editableNode(ret, ret->tail, 0);
+		tail->slots[(ret->size - 1) & PV_MASK] = NULL;
+		if(tail != ret->tail)
+		{
+			releaseNode(ret->tail, 0);
+			ret->tail = tail;
+		}
+	}
+	else if(ret->size == 1)
+	{
+		releaseNode(ret->tail, 0);
+		ret->tail = newNode(ret->edit);
+	}
+	else
+	{
+		/* the rightmost leaf of the trie becomes the new tail */
+		PVNode *tail = retainNode(leafFor(ret, ret->size - 2));
+		PVNode *root = popTail(ret, ret->shift, ret->root);
+
+		if(root != ret->root)
+			releaseNode(ret->root, ret->shift);
+		if(!root)
+			root = newNode(ret->edit);
+		if(ret->shift > PV_BITS && !root->slots[1])
+		{
+			PVNode *child = retainNode(root->slots[0]);
+			releaseNode(root, ret->shift);
+			root = child;
+			ret->shift -= PV_BITS;
+		}
+		ret->root = root;
+		releaseNode(ret->tail, 0);
+		ret->tail = tail;
+	}
+	ret->size--;
+
+	return ret;
+}
+
+/*
+ * Print a version to the console.
+ *
+ * @param PV pointer to the version
+ *
+ * @return void
+ */
+void pv_print(PV *pv)
+{
+	assert(pv);
+	assert(pv->printFn);
+
+	unsigned long i;
+	for(i = 0; i < pv->size; i++)
+	{
+		printf("index: %ld data: ", i);
+		pv->printFn(pv_get(pv, i));
+	}
+	puts("---");
+}
@@ -0,0 +1,41 @@
+#ifndef PV_H
+#define PV_H
+
+#include "al.h"
+
+#define PV_BITS 5
+#define PV_WIDTH (1 << PV_BITS)
+#define PV_MASK (PV_WIDTH - 1)
+
+typedef struct PersistentVectorNode
+{
+	unsigned long refs;
+	unsigned long edit;
+	void *slots[PV_WIDTH];
+} PVNode;
+
+typedef struct PersistentVector
+{
+	unsigned long refs;
+	unsigned long size;
+	unsigned int shift;
+	unsigned long edit;
+	PVNode *root;
+	PVNode *tail;
+	void (*printFn)(void*);
+} PV;
+
+PV* pv_create(void);
+PV* pv_fromAL(AL *list);
+PV* pv_retain(PV *pv);
+void pv_release(PV *pv);
+PV* pv_transient(PV *pv);
+PV* pv_persistent(PV *pv);
+unsigned long pv_size(PV *pv);
+void* pv_get(PV *pv, unsigned long index);
+PV* pv_set(PV *pv, unsigned long index, void *data);
+PV* pv_push(PV *pv, void *data);
+PV* pv_pop(PV *pv);
+void pv_print(PV *pv);
+
+#endif